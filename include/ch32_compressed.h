@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed firmware images as written by tools/ch32_compress.py.
+//
+// A 16-byte header is followed by one block per 256-byte page of the image, the last one covering
+// what is left. Each block is a little-endian 16-bit size and that many bytes of LZ4 block format
+// sequences, where a block may also end with a match. Matches may reach back into earlier pages up
+// to the window size, but never past the end of their own page. All fields are little-endian.
+#define CH32_COMPRESSED_MAGIC   0x5A323343 // "C32Z"
+#define CH32_COMPRESSED_VERSION 1
+
+typedef struct ch32_compressed_header {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  window_log; // Matches reach back at most 1 << window_log bytes.
+    uint16_t reserved;
+    uint32_t length;     // Size of the decompressed image.
+    uint32_t crc;        // CRC32 of the image padded to whole pages, as computed by the CH32 CRC unit.
+} ch32_compressed_header_t;
+
+typedef struct ch32_decompressor {
+    ch32_compressed_header_t header;
+
+    uint8_t const *src;
+    size_t         src_len;
+    size_t         src_pos;
+
+    uint8_t *window;   // Last decoded bytes, the current page among them.
+    size_t   produced; // Bytes decoded so far.
+    size_t   consumed; // Bytes read from the decoded pages so far.
+    uint32_t crc;      // Of the pages decoded so far.
+
+    uint8_t const *block;     // Compressed block of the last decoded page.
+    size_t         block_len;
+} ch32_decompressor_t;
+
+// Whether `data` starts with a header this version can decompress.
+bool ch32_compressed_detect(void const *data, size_t len);
+
+// Set up decompression of `data`, which must stay valid until ch32_decompressor_free. Allocates
+// the window.
+bool ch32_decompressor_init(ch32_decompressor_t *decompressor, void const *data, size_t len);
+void ch32_decompressor_free(ch32_decompressor_t *decompressor);
+
+// A ch32_reader_t producing the decompressed image, `ctx` being the decompressor. Fails on corrupt
+// blocks and when the image does not match the header's CRC, which is checked with the last page.
+int ch32_decompressor_read(void *ctx, void *buffer, size_t len);
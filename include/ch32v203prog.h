@@ -7,12 +7,155 @@
 
 #pragma once
 
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "rvswd.h"
 
 
 
+typedef enum ch32_verify {
+    CH32_VERIFY_READBACK = 0, // Read every programmed page back over the wire.
+    CH32_VERIFY_CRC      = 1, // Compare a CRC32 computed by the target's CRC unit, read back only pages that mismatch.
+} ch32_verify_t;
+
+typedef struct ch32_program_options {
+    bool          use_loader;        // Upload a routine to target SRAM that erases, programs and verifies each page itself.
+    ch32_verify_t verify;            // How pages are verified without the loader, which always verifies on the target.
+    bool          differential;      // Only erase and program pages whose content differs from the image.
+    bool          skip_if_identical; // Check the whole image first and only restart the target if it matches.
+    bool          elide_blank;       // Only erase pages that are entirely 0xFF in the image, without programming them.
+    bool          skip_blank;        // With elide_blank, leave blank pages alone when the target page already reads blank.
+    bool          plan_erase;        // Erase up front with the quickest mix of mass, 4 KiB sector and 256-byte page erases.
+    bool          target_decompress; // With use_loader, send compressed images as they are and expand pages on the target.
+    bool          fast_restart;      // Reset the target without first requesting a halt, it is halted already.
+} ch32_program_options_t;
+
+// Reads up to `len` bytes of the image into `buffer`, returning the number of bytes read, 0 at the end of the
+// image or a negative value on error. Called for consecutive parts of the image from the start.
+typedef int (*ch32_reader_t)(void *ctx, void *buffer, size_t len);
+
+typedef struct ch32_partition_benchmark {
+    int64_t copy_us;   // Allocating, reading the image into heap and taking its pages.
+    int64_t mmap_us;   // Mapping the image and taking its pages in place.
+    size_t  copy_heap; // Heap used by the copy, the mapping uses none.
+} ch32_partition_benchmark_t;
+
+// Operations waited for by polling the target.
+typedef enum ch32_wait_op {
+    CH32_WAIT_FLASH  = 0, // A flash erase or program.
+    CH32_WAIT_HALT   = 1,
+    CH32_WAIT_RESUME = 2,
+    CH32_WAIT_RESET  = 3,
+    CH32_WAIT_LOADER = 4, // The flash loader handling one page.
+    CH32_WAIT_RUN    = 5, // The processor running after a reset.
+    CH32_WAIT_COUNT,
+} ch32_wait_op_t;
+
+typedef struct ch32_wait_stats {
+    uint32_t waits;
+    uint32_t timeouts;
+    uint32_t polls;    // Status reads over all waits.
+    uint32_t yields;   // Waits that took long enough to sleep between polls.
+    int64_t  total_us;
+    int64_t  max_us;
+} ch32_wait_stats_t;
+
+typedef struct ch32_job ch32_job_t;
+
+typedef enum ch32_job_state {
+    CH32_JOB_RUNNING   = 0,
+    CH32_JOB_DONE      = 1, // Programmed and restarted.
+    CH32_JOB_FAILED    = 2,
+    CH32_JOB_CANCELLED = 3, // Stopped between pages, the target is left halted with flash locked.
+} ch32_job_state_t;
+
+typedef struct ch32_job_event {
+    ch32_job_t      *job;
+    ch32_job_state_t state; // CH32_JOB_RUNNING for progress, the final state once the job is done.
+    char             message[64];
+    int              progress;
+    int              total;
+} ch32_job_event_t;
+
+typedef void (*ch32_job_callback_t)(ch32_job_event_t const *event, void *ctx);
+
+typedef struct ch32_job_config {
+    ch32_program_options_t options;
+    ch32_job_callback_t    callback;     // Called from the job's task, may be NULL.
+    void                  *callback_ctx;
+    QueueHandle_t          queue;        // Receives copies of events, dropped when full, may be NULL.
+    uint32_t               stack_size;   // Of the job's task, 0 for the default.
+    UBaseType_t            priority;     // Of the job's task, 0 for the default.
+} ch32_job_config_t;
+
 // Optional user-defined status update callback.
 void ch32_status_callback(char const *msg, int progress, int total);
 
+// Give up waiting for `op` after `timeout_us`. Waits poll busily with a short, growing delay and
+// only sleep a tick between polls once they took `yield_us`. The timeouts and statistics are shared
+// by all handles and guarded by a critical section, so jobs on other tasks may use them concurrently.
+void ch32_wait_configure(ch32_wait_op_t op, uint32_t timeout_us, uint32_t yield_us);
+
+// Statistics of the waits for `op` so far, cleared afterwards with `reset`.
+void ch32_wait_statistics(ch32_wait_op_t op, ch32_wait_stats_t *stats, bool reset);
+
+// Identify the attached part and cache its flash geometry in handle->target, the hart must be halted.
+// Programming probes by itself.
+bool ch32_probe(rvswd_handle_t *handle);
+
+// CRC32 as computed by the CH32 CRC unit over `count` words, starting from 0xFFFFFFFF after a reset.
+uint32_t ch32_crc32(uint32_t crc, uint32_t const *words, size_t count);
+
 // Program and restart the CH32V203.
 void ch32_program(rvswd_handle_t *handle, void const *firmware, size_t firmware_len);
+
+// Program and restart the CH32V203 with non-default options, returns false on failure. Images made by
+// tools/ch32_compress.py are recognized and decompressed with ch32_program_compressed.
+bool ch32_program_with_options(rvswd_handle_t *handle, void const *firmware, size_t firmware_len,
+                               ch32_program_options_t const *options);
+
+// Program and restart the CH32V203 with an image pulled from `reader` one 256-byte page at a time, so
+// memory use does not depend on the image size. Pages are planned as they arrive, skip_if_identical
+// is not supported. With plan_erase every page is erased up front, which leaves nothing for
+// differential to compare against.
+bool ch32_program_stream(rvswd_handle_t *handle, ch32_reader_t reader, void *reader_ctx, size_t firmware_len,
+                         ch32_program_options_t const *options);
+
+// Program and restart the CH32V203 from an image made by tools/ch32_compress.py, decompressed one page
+// at a time into a window of at most 64 KiB set in the image. Planned like ch32_program_stream, but
+// the image's CRC makes skip_if_identical possible.
+bool ch32_program_compressed(rvswd_handle_t *handle, void const *compressed, size_t compressed_len,
+                             ch32_program_options_t const *options);
+
+// Program and restart the CH32V203 with `len` bytes at `offset` of `partition`, mapped into memory
+// and fed to the page writers without copying.
+bool ch32_program_partition(rvswd_handle_t *handle, esp_partition_t const *partition, size_t offset, size_t len,
+                            ch32_program_options_t const *options);
+
+// Compare taking an image's pages from a heap copy against taking them from a mapping of
+// `partition`, without a target. Returns false when either path fails or their content differs.
+bool ch32_benchmark_partition(esp_partition_t const *partition, size_t offset, size_t len,
+                              ch32_partition_benchmark_t *result);
+
+// Restart the CH32V203 without programming it, resetting it straight away instead of halting it
+// first. Returns once the target is confirmed running.
+bool ch32_restart(rvswd_handle_t *handle);
+
+// Program and restart the CH32V203 on a task of its own, returning at once. Progress and the final
+// state are reported as events instead of through ch32_status_callback. `firmware` must stay valid
+// until the job is done. Returns NULL when the job could not be started.
+ch32_job_t *ch32_job_start(rvswd_handle_t *handle, void const *firmware, size_t firmware_len,
+                           ch32_job_config_t const *config);
+
+ch32_job_state_t ch32_job_state(ch32_job_t const *job);
+
+// Ask the job to stop at the next page boundary. A page being programmed is finished and verified
+// first, so the target ends up halted in a known state.
+void ch32_job_cancel(ch32_job_t *job);
+
+// Wait up to `timeout` for the job to be done, returning its state, CH32_JOB_RUNNING on timeout.
+ch32_job_state_t ch32_job_wait(ch32_job_t *job, TickType_t timeout);
+
+// Cancel the job if it still runs, wait for it and release it.
+void ch32_job_free(ch32_job_t *job);
@@ -1,4 +1,3 @@
-
 /**
  * Copyright (c) 2024 Nicolai Electronics
  *
@@ -10,12 +9,11 @@
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef struct rvswd_handle {
-    gpio_num_t swdio;
-    gpio_num_t swclk;
-} rvswd_handle_t;
+typedef struct rvswd_handle rvswd_handle_t;
 
 typedef enum rvswd_result {
     RVSWD_OK           = 0,
@@ -24,7 +22,140 @@ typedef enum rvswd_result {
     RVSWD_PARITY_ERROR = 3,
 } rvswd_result_t;
 
+// A single register access in a batch.
+typedef struct rvswd_op {
+    uint8_t   reg;
+    bool      write;
+    uint32_t  value;  // Value to write.
+    uint32_t *result; // Where to store the value read, may be NULL.
+} rvswd_op_t;
+
+// Bit-bang timing. The start and stop conditions are clocked from the CPU in every transport
+// except RMT, so the hold times apply to those as well; the half-period only to the GPIO engines.
+typedef struct rvswd_timing {
+    uint16_t half_period_ns; // Extra SWCLK low and high time per bit, 0 runs as fast as the CPU toggles the pins.
+    uint16_t start_hold_ns;  // Length of each step of the start condition, the idle-high step is held twice as long.
+    uint16_t stop_hold_ns;   // Length of each step of the stop condition, SWCLK high is held twice as long.
+} rvswd_timing_t;
+
+// The conservative timing the bit-bang engine has always used.
+extern rvswd_timing_t const rvswd_timing_default;
+
+// Caller-owned queue of register accesses, built up front and submitted in one go.
+typedef struct rvswd_batch {
+    rvswd_op_t *ops;
+    size_t      capacity;
+    size_t      count;
+} rvswd_batch_t;
+
+// Operations implemented by an RVSWD transport. Operations left NULL fall back to a generic
+// implementation: `init` and `reset` to the bit-bang engine, `batch` to one write / read per op.
+typedef struct rvswd_transport {
+    char const *name;
+    rvswd_result_t (*init)(rvswd_handle_t *handle);
+    rvswd_result_t (*reset)(rvswd_handle_t *handle);
+    rvswd_result_t (*write)(rvswd_handle_t *handle, uint8_t reg, uint32_t value);
+    rvswd_result_t (*read)(rvswd_handle_t *handle, uint8_t reg, uint32_t *value);
+    rvswd_result_t (*batch)(rvswd_handle_t *handle, rvswd_op_t *ops, size_t count);
+} rvswd_transport_t;
+
+// Bit-bang through gpio_set_level / gpio_get_level. Used when a handle has no transport set.
+extern rvswd_transport_t const rvswd_transport_gpio;
+// Bit-bang by writing the GPIO set / clear / input registers directly.
+extern rvswd_transport_t const rvswd_transport_gpio_direct;
+
+// Precomputed register access for one pin, used by the direct GPIO paths.
+typedef struct rvswd_gpio_regs {
+    volatile uint32_t *w1ts;
+    volatile uint32_t *w1tc;
+    volatile uint32_t *in;
+    uint32_t           mask;
+} rvswd_gpio_regs_t;
+
+// Frame counters, maintained for every transport.
+typedef struct rvswd_stats {
+    uint32_t writes;
+    uint32_t reads;
+    uint32_t errors;
+} rvswd_stats_t;
+
+// Debug module program buffer contents as last written through this handle, so callers can skip
+// rewriting registers that already hold the right instructions.
+typedef struct rvswd_progbuf_cache {
+    uint32_t words[8];
+    uint8_t  valid;        // Bit n set when words[n] matches PROGBUFn.
+    uint32_t writes_saved; // PROGBUF writes skipped because the content was already loaded.
+} rvswd_progbuf_cache_t;
+
+// Hart general-purpose registers as last written or read by the debugger while halted, so callers
+// can skip abstract register writes that would not change anything.
+typedef struct rvswd_gpr_cache {
+    uint32_t values[32];
+    uint32_t valid;        // Bit n set when values[n] matches xn.
+    uint32_t writes_saved; // Register writes skipped because the hart already held the value.
+} rvswd_gpr_cache_t;
+
+// Identity and flash layout of the attached part, filled in by chip support code such as ch32_probe.
+// Valid when flash_size is non-zero. The transport layer does not use it; it is kept here because the
+// handle is the only per-target state shared by the chip support code, which builds on this header.
+typedef struct rvswd_target {
+    uint32_t    chip_id;
+    char const *name;           // NULL for parts missing from the variant table.
+    uint32_t    flash_base;
+    uint32_t    flash_size;     // In bytes.
+    uint32_t    zero_wait_size; // Bytes from flash_base that execute without wait states.
+    uint16_t    page_size;      // Smallest erase and program unit.
+    uint16_t    sector_size;    // Unit of the regular sector erase.
+} rvswd_target_t;
+
+// Flash-busy time of each erase operation of the attached part as last measured, 0 until measured.
+// Kept across rvswd_init, unlike the target identity, so estimates improve from one run to the next.
+typedef struct rvswd_erase_times {
+    uint32_t page_us;
+    uint32_t sector_us;
+    uint32_t mass_us;
+} rvswd_erase_times_t;
+
+struct rvswd_handle {
+    gpio_num_t               swdio;
+    gpio_num_t               swclk;
+    rvswd_transport_t const *transport;     // NULL selects rvswd_transport_gpio.
+    void                    *transport_ctx; // Owned by the transport.
+    rvswd_timing_t const    *timing;        // NULL selects rvswd_timing_default.
+
+    // Filled in by rvswd_init.
+    rvswd_gpio_regs_t swdio_regs;
+    rvswd_gpio_regs_t swclk_regs;
+
+    rvswd_stats_t         stats;
+    rvswd_progbuf_cache_t progbuf;
+    rvswd_gpr_cache_t     gpr;
+    rvswd_target_t        target;
+    rvswd_erase_times_t   erase_times;
+};
+
 rvswd_result_t rvswd_init(rvswd_handle_t *handle);
 rvswd_result_t rvswd_reset(rvswd_handle_t *handle);
 rvswd_result_t rvswd_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value);
 rvswd_result_t rvswd_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value);
+
+// Forget the cached program buffer and register contents. Called by rvswd_init and rvswd_reset;
+// callers must also invalidate after anything that may change them behind the cache's back, such
+// as resuming or resetting the hart.
+void rvswd_progbuf_invalidate(rvswd_handle_t *handle);
+void rvswd_gpr_invalidate(rvswd_handle_t *handle);
+
+// Execute a sequence of register accesses back-to-back, stopping at the first failure.
+rvswd_result_t rvswd_transfer(rvswd_handle_t *handle, rvswd_op_t *ops, size_t count);
+
+// Queue register accesses into a preallocated descriptor array. Reads land in `result` once the
+// batch has been submitted. Returns RVSWD_INVALID_ARGS when the batch is full.
+void           rvswd_batch_init(rvswd_batch_t *batch, rvswd_op_t *ops, size_t capacity);
+rvswd_result_t rvswd_batch_write(rvswd_batch_t *batch, uint8_t reg, uint32_t value);
+rvswd_result_t rvswd_batch_read(rvswd_batch_t *batch, uint8_t reg, uint32_t *result);
+
+// Execute all queued accesses back-to-back and empty the batch.
+rvswd_result_t rvswd_batch_submit(rvswd_handle_t *handle, rvswd_batch_t *batch);
+
+// Time `count` reads of `reg` and report the effective wire rate in clocked bits per second.
+rvswd_result_t rvswd_measure_bitrate(rvswd_handle_t *handle, uint8_t reg, uint32_t count, uint32_t *bits_per_second);
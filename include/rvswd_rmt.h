@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "rvswd.h"
+
+#include <stdint.h>
+
+typedef struct rvswd_rmt_config {
+    uint32_t resolution_hz;     // RMT tick rate, e.g. 10 MHz for 100 ns ticks.
+    uint16_t half_period_ticks; // SWCLK low and high time; SWCLK runs at resolution_hz / (2 * half_period_ticks).
+    uint16_t hold_ticks;        // Length of each step of the start and stop conditions.
+} rvswd_rmt_config_t;
+
+// Play frames out as pre-encoded RMT symbol streams with hardware timing.
+extern rvswd_transport_t const rvswd_transport_rmt;
+
+// Claim RMT channels for the handle's pins and select rvswd_transport_rmt.
+// SWCLK and SWDIO each get a TX channel started in lockstep by a sync manager, a third RX
+// channel captures SWDIO and the returned data bits are decoded from the capture timing.
+// Requires a chip with synchronized RMT TX channels (SOC_RMT_SUPPORT_TX_SYNCHRO).
+rvswd_result_t rvswd_rmt_attach(rvswd_handle_t *handle, rvswd_rmt_config_t const *config);
+
+// Release the RMT channels and fall back to rvswd_transport_gpio_direct.
+rvswd_result_t rvswd_rmt_detach(rvswd_handle_t *handle);
@@ -0,0 +1,34 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "rvswd.h"
+
+#include <stdint.h>
+
+// Memory seen by the simulated hart. Accesses are 32-bit and aligned; narrower loads and stores
+// are performed as read-modify-write of the containing word.
+typedef struct rvswd_sim_config {
+    uint32_t (*read_memory)(void *user, uint32_t address);
+    void (*write_memory)(void *user, uint32_t address, uint32_t value);
+    void    *user;
+    uint32_t reset_vector; // Where the hart starts after a core reset.
+    uint32_t run_slice;    // Instructions a running hart executes per RVSWD frame, 0 for the default.
+} rvswd_sim_config_t;
+
+// Software model of the debug module and an RV32I hart, for running the programmer without a target.
+// The DM implements DATA0/1, DMCONTROL, DMSTATUS, ABSTRACTCS, COMMAND (access register, with
+// postexec), ABSTRACTAUTO and PROGBUF0..7. The hart executes RV32I plus the compressed
+// instructions used by the programmer (C.LW, C.SW, C.ADDI, C.LI, C.MV, C.ADD, C.J, C.BEQZ,
+// C.BNEZ, C.EBREAK), both from the program buffer and, when resumed, from memory.
+extern rvswd_transport_t const rvswd_transport_sim;
+
+// Only built with CONFIG_RVSWD_SIMULATOR enabled.
+rvswd_result_t rvswd_sim_attach(rvswd_handle_t *handle, rvswd_sim_config_t const *config);
+
+// Release the simulated target and fall back to rvswd_transport_gpio_direct.
+rvswd_result_t rvswd_sim_detach(rvswd_handle_t *handle);
@@ -0,0 +1,30 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "driver/spi_master.h"
+#include "rvswd.h"
+
+#include <stdbool.h>
+
+typedef struct rvswd_spi_config {
+    spi_host_device_t host;           // SPI host dedicated to the RVSWD bus, e.g. SPI2_HOST.
+    int               clock_speed_hz; // SWCLK frequency while a frame is being clocked out.
+    int               input_delay_ns; // SWDIO input delay, see spi_device_interface_config_t.
+    bool              polling;        // Busy-wait for frame completion instead of blocking on the interrupt.
+} rvswd_spi_config_t;
+
+// Clock frames out through an SPI master with DMA.
+extern rvswd_transport_t const rvswd_transport_spi;
+
+// Claim an SPI host for the handle's pins and select rvswd_transport_spi.
+// SWCLK is driven by SCLK and SWDIO by MOSI in 3-wire half-duplex mode. The start and stop
+// conditions, which the SPI peripheral cannot produce, are generated on the GPIO matrix.
+rvswd_result_t rvswd_spi_attach(rvswd_handle_t *handle, rvswd_spi_config_t const *config);
+
+// Release the SPI bus and fall back to rvswd_transport_gpio_direct.
+rvswd_result_t rvswd_spi_detach(rvswd_handle_t *handle);
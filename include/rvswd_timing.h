@@ -0,0 +1,28 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "rvswd.h"
+
+#include <stdint.h>
+
+// Find the fastest timing that reads back a known register pattern without errors.
+// DMSTATUS and CPBR are first read with rvswd_timing_default as the reference. The sweep then
+// picks the shortest half-period that still matches with the default hold times and shortens the
+// start and stop holds step by step, each candidate having to match the reference `trials` times
+// in a row. The sweep stops at the first failing step. On success `result` holds the chosen timing
+// and the handle is switched to it, so `result` must outlive the handle's use.
+rvswd_result_t rvswd_timing_tune(rvswd_handle_t *handle, uint32_t trials, rvswd_timing_t *result);
+
+// Store and retrieve a timing in NVS under `key` (at most 15 characters) in the "rvswd" namespace.
+// NVS must have been initialized by the application with nvs_flash_init.
+rvswd_result_t rvswd_timing_load(char const *key, rvswd_timing_t *timing);
+rvswd_result_t rvswd_timing_save(char const *key, rvswd_timing_t const *timing);
+
+// Start from the timing stored under `key` if it still passes `trials` reads of the reference
+// pattern, otherwise tune and store the new result. The handle is switched to `timing`.
+rvswd_result_t rvswd_timing_autotune(rvswd_handle_t *handle, char const *key, uint32_t trials, rvswd_timing_t *timing);
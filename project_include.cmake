@@ -0,0 +1,23 @@
+# Build helpers for projects using this component.
+
+# ch32_compressed_image(<target> <bin>)
+#
+# Compress the CH32 firmware <bin> with tools/ch32_compress.py at build time and embed the result in
+# <target>, usually ${COMPONENT_LIB}. The image is available as the symbols
+# _binary_<name>_ch32z_start and _binary_<name>_ch32z_end, <name> being the file name of <bin> without
+# extension, and can be passed to ch32_program or ch32_program_compressed.
+function(ch32_compressed_image target bin)
+    get_filename_component(bin_path "${bin}" ABSOLUTE)
+    get_filename_component(bin_name "${bin}" NAME_WE)
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${bin_name}.ch32z")
+
+    idf_build_get_property(python PYTHON)
+    add_custom_command(
+        OUTPUT "${output}"
+        COMMAND ${python} "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/tools/ch32_compress.py" "${bin_path}" "${output}"
+        DEPENDS "${bin_path}" "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/tools/ch32_compress.py"
+        COMMENT "Compressing ${bin_name} for the CH32"
+        VERBATIM)
+    add_custom_target(${bin_name}_ch32z DEPENDS "${output}")
+    target_add_binary_data(${target} "${output}" BINARY DEPENDS ${bin_name}_ch32z)
+endfunction()
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ch32_compressed.h"
+
+#include "ch32v203prog.h"
+#include "esp_log.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const TAG[] = "ch32_compressed";
+
+#define CH32_COMPRESSED_HEADER_SIZE 16
+#define CH32_COMPRESSED_PAGE_SIZE   256
+// LZ4 matches are at least this long, the token holds the length beyond it.
+#define CH32_COMPRESSED_MIN_MATCH   4
+
+static uint16_t ch32_le16(uint8_t const *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t ch32_le32(uint8_t const *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool ch32_compressed_parse(void const *data, size_t len, ch32_compressed_header_t *header) {
+    uint8_t const *p = data;
+    if (len < CH32_COMPRESSED_HEADER_SIZE) {
+        return false;
+    }
+    header->magic      = ch32_le32(p);
+    header->version    = p[4];
+    header->window_log = p[5];
+    header->reserved   = ch32_le16(p + 6);
+    header->length     = ch32_le32(p + 8);
+    header->crc        = ch32_le32(p + 12);
+    return header->magic == CH32_COMPRESSED_MAGIC && header->version == CH32_COMPRESSED_VERSION &&
+           header->window_log >= 8 && header->window_log <= 16;
+}
+
+bool ch32_compressed_detect(void const *data, size_t len) {
+    ch32_compressed_header_t header;
+    return ch32_compressed_parse(data, len, &header);
+}
+
+bool ch32_decompressor_init(ch32_decompressor_t *decompressor, void const *data, size_t len) {
+    memset(decompressor, 0, sizeof(*decompressor));
+    if (!ch32_compressed_parse(data, len, &decompressor->header)) {
+        ESP_LOGE(TAG, "Not a compressed image");
+        return false;
+    }
+    decompressor->src     = data;
+    decompressor->src_len = len;
+    decompressor->src_pos = CH32_COMPRESSED_HEADER_SIZE;
+    decompressor->crc     = 0xFFFFFFFF;
+    decompressor->window  = malloc(1 << decompressor->header.window_log);
+    if (decompressor->window == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        return false;
+    }
+    return true;
+}
+
+void ch32_decompressor_free(ch32_decompressor_t *decompressor) {
+    free(decompressor->window);
+    decompressor->window = NULL;
+}
+
+// Read an LZ4 length extension: bytes are added until one is not 255.
+static bool ch32_read_length(uint8_t const **in, uint8_t const *in_end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in == in_end) {
+            return false;
+        }
+        byte     = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decode the next block into the window and add its page to the CRC.
+static bool ch32_decompress_page(ch32_decompressor_t *decompressor) {
+    size_t   size   = (size_t)1 << decompressor->header.window_log;
+    size_t   mask   = size - 1;
+    uint8_t *window = decompressor->window;
+
+    size_t start = decompressor->produced;
+    size_t end   = start + CH32_COMPRESSED_PAGE_SIZE;
+    if (end > decompressor->header.length) {
+        end = decompressor->header.length;
+    }
+
+    if (decompressor->src_len - decompressor->src_pos < 2) {
+        return false;
+    }
+    size_t block_len       = ch32_le16(decompressor->src + decompressor->src_pos);
+    decompressor->src_pos += 2;
+    if (decompressor->src_len - decompressor->src_pos < block_len) {
+        return false;
+    }
+    uint8_t const *in       = decompressor->src + decompressor->src_pos;
+    uint8_t const *in_end   = in + block_len;
+    decompressor->src_pos   += block_len;
+    decompressor->block     = in;
+    decompressor->block_len = block_len;
+
+    size_t out = start;
+    while (in < in_end) {
+        uint8_t token    = *in++;
+        size_t  literals = token >> 4;
+        if (literals == 15 && !ch32_read_length(&in, in_end, &literals)) {
+            return false;
+        }
+        if ((size_t)(in_end - in) < literals || end - out < literals) {
+            return false;
+        }
+        for (size_t i = 0; i < literals; i++) {
+            window[out++ & mask] = *in++;
+        }
+
+        // The last sequence of a block has no match.
+        if (in == in_end) {
+            break;
+        }
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset  = ch32_le16(in);
+        in            += 2;
+        size_t match   = token & 15;
+        if (match == 15 && !ch32_read_length(&in, in_end, &match)) {
+            return false;
+        }
+        match += CH32_COMPRESSED_MIN_MATCH;
+        if (offset == 0 || offset > out || offset > size || end - out < match) {
+            return false;
+        }
+        // Byte by byte, matches may overlap their own output.
+        for (size_t i = 0; i < match; i++, out++) {
+            window[out & mask] = window[(out - offset) & mask];
+        }
+    }
+    if (out != end) {
+        return false;
+    }
+
+    uint32_t page[CH32_COMPRESSED_PAGE_SIZE / 4];
+    memset(page, 0xFF, sizeof(page));
+    for (size_t i = start; i < end; i++) {
+        ((uint8_t *)page)[i - start] = window[i & mask];
+    }
+    decompressor->crc      = ch32_crc32(decompressor->crc, page, CH32_COMPRESSED_PAGE_SIZE / 4);
+    decompressor->produced = end;
+    return true;
+}
+
+int ch32_decompressor_read(void *ctx, void *buffer, size_t len) {
+    ch32_decompressor_t *decompressor = ctx;
+    size_t               mask         = ((size_t)1 << decompressor->header.window_log) - 1;
+
+    if (decompressor->consumed == decompressor->produced) {
+        if (decompressor->produced == decompressor->header.length) {
+            return 0;
+        }
+        if (!ch32_decompress_page(decompressor)) {
+            ESP_LOGE(TAG, "Corrupt block for offset %zu", decompressor->produced);
+            return -1;
+        }
+        if (decompressor->produced == decompressor->header.length && decompressor->crc != decompressor->header.crc) {
+            ESP_LOGE(TAG, "CRC mismatch, image %08" PRIx32 ", header %08" PRIx32, decompressor->crc,
+                     decompressor->header.crc);
+            return -1;
+        }
+    }
+
+    size_t chunk = decompressor->produced - decompressor->consumed;
+    if (chunk > len) {
+        chunk = len;
+    }
+    for (size_t i = 0; i < chunk; i++) {
+        ((uint8_t *)buffer)[i] = decompressor->window[(decompressor->consumed + i) & mask];
+    }
+    decompressor->consumed += chunk;
+    return chunk;
+}
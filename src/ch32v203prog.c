@@ -7,7 +7,14 @@
 
 #include "ch32v203prog.h"
 
+#include "ch32_compressed.h"
 #include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "stdlib.h"
 #include "string.h"
 
 static char const TAG[] = "ch32v203prog";
@@ -37,13 +44,68 @@ static char const TAG[] = "ch32v203prog";
 #define CH32_REGS_CSR 0x0000 // Offsets for accessing CSRs.
 #define CH32_REGS_GPR 0x1000 // Offsets for accessing general-purpose (x)registers.
 
+#define CH32_CSR_MSTATUS 0x300 // Machine status register.
+#define CH32_CSR_DCSR    0x7B0 // Debug control and status register.
+#define CH32_CSR_DPC     0x7B1 // Debug PC, where the hart continues when resumed.
+
+// Interrupts enabled in machine mode.
+#define CH32_MSTATUS_MIE (1 << 3)
+// Single step.
+#define CH32_DCSR_STEP    (1 << 2)
+// Make ebreak in machine mode enter debug mode (halt) instead of raising an exception.
+#define CH32_DCSR_EBREAKM (1 << 15)
+
 #define CH32_CFGR_KEY   0x5aa50000
 #define CH32_CFGR_OUTEN (1 << 10)
 
+// Where the flash loader is placed in SRAM.
+#define CH32_LOADER_ADDR       0x20000000
+// SRAM buffers the loader programs pages from, used in turn. Two are enough to upload a page while
+// the previous one programs, the one before that has been verified by then.
+#define CH32_LOADER_BUFFER       0x20000400
+#define CH32_LOADER_BUFFER_COUNT 2
+// SRAM buffer for a compressed page the loader expands into a page buffer.
+#define CH32_LOADER_PACKED 0x20000600
+// Argument registers a0 to a5 the loader takes.
+#define CH32_LOADER_ARGS 6
+// Longest time the loader may take for one page, by default.
+#define CH32_LOADER_TIMEOUT_US 100000
+
+// Waits poll busily, the delay between status reads doubling from the minimum to the maximum, until
+// they have taken the yield time of their operation. From then on they sleep a tick per poll.
+#define CH32_WAIT_BACKOFF_MIN_US 2
+#define CH32_WAIT_BACKOFF_MAX_US 256
+
+// Defaults for the task running a programming job.
+#define CH32_JOB_STACK_SIZE 6144
+#define CH32_JOB_PRIORITY   5
+
 // The start of CH32 CODE FLASH region.
 #define CH32_CODE_BEGIN 0x08000000
-// the end of the CH32 CODE FLASH region.
-#define CH32_CODE_END   0x08004000
+// Flash of the smallest CH32V203, assumed while the part has not been probed.
+#define CH32_CODE_MIN_SIZE (32 * 1024)
+
+// CRC calculation unit data register, each word written is added to the CRC.
+#define CH32_CRC_DATAR      0x40023000
+// CRC calculation unit control register.
+#define CH32_CRC_CTLR       0x40023008
+// Reset the CRC to 0xFFFFFFFF.
+#define CH32_CRC_CTLR_RESET (1 << 0)
+
+// RCC AHB peripheral clock enable register.
+#define CH32_RCC_AHBPCENR       0x40021014
+// CRC calculation unit clock enable.
+#define CH32_RCC_AHBPCENR_CRCEN (1 << 6)
+
+// Flash capacity in KiB, in the low half-word.
+#define CH32_FLASH_SIZE_REG 0x1FFFF7E0
+// Chip ID, the upper half-word identifies the variant and the low byte the revision.
+#define CH32_CHIP_ID_REG    0x1FFFF704
+
+// Size of a sector erased by PER.
+#define CH32_FLASH_SECTOR_SIZE 4096
+// Size of a page erased by FTER and programmed by FTPG.
+#define CH32_FLASH_PAGE_SIZE   256
 
 // FLASH status register.
 #define CH32_FLASH_STATR 0x4002200C
@@ -61,7 +123,7 @@ static char const TAG[] = "ch32v203prog";
 
 // Perform standard programming operation.
 #define CH32_FLASH_CTLR_PG     (1 << 0)
-// Perform 1K sector erase.
+// Perform 4K sector erase.
 #define CH32_FLASH_CTLR_PER    (1 << 1)
 // Perform full FLASH erase.
 #define CH32_FLASH_CTLR_MER    (1 << 2)
@@ -86,25 +148,291 @@ uint8_t const ch32_readmem[] = {0x88, 0x41, 0x02, 0x90};
 
 uint8_t const ch32_writemem[] = {0x88, 0xc1, 0x02, 0x90};
 
+// c.sw a0, 0(a1); c.addi a1, 4; c.ebreak
+uint8_t const ch32_writemem_inc[] = {0x88, 0xc1, 0x91, 0x05, 0x02, 0x90};
+
+// c.sw a0, 0(a1); c.addi a1, 4; 1: c.lw a3, 0(a2); andi a3, a3, 2; c.bnez a3, 1b; c.ebreak
+// Stores into the fast programming buffer and waits for STATR (a2) to drop WRBUSY before returning.
+uint8_t const ch32_writemem_flash[] = {0x88, 0xc1, 0x91, 0x05, 0x14, 0x42, 0x93, 0xf6, 0x26, 0x00, 0xed, 0xfe, 0x02, 0x90};
+
+// c.lw a0, 0(a1); c.addi a1, 4; c.ebreak
+uint8_t const ch32_readmem_inc[] = {0x88, 0x41, 0x91, 0x05, 0x02, 0x90};
+
+// 1: c.lw a0, 0(a1); c.sw a0, 0(a2); c.addi a1, 4; c.addi a4, -1; c.bnez a4, 1b; c.ebreak
+// Feeds a4 words starting at a1 into the CRC unit at a2.
+uint8_t const ch32_crcmem[] = {0x88, 0x41, 0x08, 0xc2, 0x91, 0x05, 0x7d, 0x17, 0x65, 0xff, 0x02, 0x90};
+
+// Registers modified by the snippets above, as a mask of GPR numbers.
+#define CH32_READMEM_CLOBBERS        (1 << 10)
+#define CH32_WRITEMEM_CLOBBERS       0
+#define CH32_WRITEMEM_INC_CLOBBERS   (1 << 11)
+#define CH32_WRITEMEM_FLASH_CLOBBERS ((1 << 11) | (1 << 13))
+#define CH32_READMEM_INC_CLOBBERS    ((1 << 10) | (1 << 11))
+#define CH32_CRCMEM_CLOBBERS         ((1 << 10) | (1 << 11) | (1 << 14))
+
+// Flash loader, run from SRAM with the hart resumed and halting on ebreak when done. Each call
+// verifies the page started by the previous call and starts programming the next one without
+// waiting for it, so the next page can be uploaded while the flash is busy.
+// Pages may also arrive as a compressed block (see ch32_compressed.h) that the loader expands first.
+// Assembled from RV32I only, so it does not depend on the compressed extension.
+static uint32_t const ch32_loader[] = {
+    // a0 = page to erase and program, or 0 to only finish the previous one, a1 = its data in SRAM
+    // or 0 to only erase it. Bit 0 of a0 set means the page has already been erased.
+    // a2 = page started by the previous call, or 0 if none, a3 = its data in SRAM.
+    // a4 = compressed block in SRAM to expand into a1 first, or 0 if a1 holds the page, a5 = its
+    // length. Matches reaching back before the page are read from flash below a0.
+    // Returns 0 in a0 or the first mismatching address of the previous page.
+    0x400222b7, //    lui t0, 0x40022
+    // Wait for the previous page to finish programming, CTLR = 0, then verify it.
+    0x00c2a303, // 1: lw t1, 0x0C(t0)
+    0x00137313, //    andi t1, t1, 1
+    0xfe031ce3, //    bnez t1, 1b
+    0x0002a823, //    sw zero, 0x10(t0)
+    0x02060463, //    beqz a2, 3f
+    0x00060e93, //    mv t4, a2
+    0x00068f13, //    mv t5, a3
+    0x10068f93, //    addi t6, a3, 256
+    0x000ea303, // 2: lw t1, 0(t4)
+    0x000f2383, //    lw t2, 0(t5)
+    0x16731063, //    bne t1, t2, 9f
+    0x004e8e93, //    addi t4, t4, 4
+    0x004f0f13, //    addi t5, t5, 4
+    0xffff16e3, //    bne t5, t6, 2b
+    0x14050463, // 3: beqz a0, 8f
+    0x00157893, //    andi a7, a0, 1
+    0xffe57513, //    andi a0, a0, -2
+    0x0c070a63, //    beqz a4, 19f
+    // Expand LZ4 sequences: token, literal length extension, literals, offset, match length
+    // extension. Source index t2 relative to a1 is negative for bytes still in flash.
+    0x00f70fb3, //    add t6, a4, a5
+    0x00058f13, //    mv t5, a1
+    0x0bf77863, // 10: bgeu a4, t6, 20f
+    0x00074e03, //    lbu t3, 0(a4)
+    0x00170713, //    addi a4, a4, 1
+    0x004e5313, //    srli t1, t3, 4
+    0x00f00393, //    li t2, 15
+    0x00731c63, //    bne t1, t2, 12f
+    0x00074e83, // 11: lbu t4, 0(a4)
+    0x00170713, //    addi a4, a4, 1
+    0x01d30333, //    add t1, t1, t4
+    0xf01e8e93, //    addi t4, t4, -255
+    0xfe0e88e3, //    beqz t4, 11b
+    0x00030e63, // 12: beqz t1, 14f
+    0x00074e83, // 13: lbu t4, 0(a4)
+    0x01df0023, //    sb t4, 0(t5)
+    0x00170713, //    addi a4, a4, 1
+    0x001f0f13, //    addi t5, t5, 1
+    0xfff30313, //    addi t1, t1, -1
+    0xfe0316e3, //    bnez t1, 13b
+    0x07f77463, // 14: bgeu a4, t6, 20f
+    0x00074303, //    lbu t1, 0(a4)
+    0x00174e83, //    lbu t4, 1(a4)
+    0x008e9e93, //    slli t4, t4, 8
+    0x01d36333, //    or t1, t1, t4
+    0x00270713, //    addi a4, a4, 2
+    0x00fe7e13, //    andi t3, t3, 15
+    0x007e1c63, //    bne t3, t2, 16f
+    0x00074e83, // 15: lbu t4, 0(a4)
+    0x00170713, //    addi a4, a4, 1
+    0x01de0e33, //    add t3, t3, t4
+    0xf01e8e93, //    addi t4, t4, -255
+    0xfe0e88e3, //    beqz t4, 15b
+    0x004e0e13, // 16: addi t3, t3, 4
+    0x40bf03b3, //    sub t2, t5, a1
+    0x406383b3, //    sub t2, t2, t1
+    0x00758eb3, // 17: add t4, a1, t2
+    0x0003d463, //    bgez t2, 18f
+    0x00750eb3, //    add t4, a0, t2
+    0x000ece83, // 18: lbu t4, 0(t4)
+    0x01df0023, //    sb t4, 0(t5)
+    0x001f0f13, //    addi t5, t5, 1
+    0x00138393, //    addi t2, t2, 1
+    0xfffe0e13, //    addi t3, t3, -1
+    0xfe0e10e3, //    bnez t3, 17b
+    0xf55ff06f, //    j 10b
+    // Pad a short last page with 0xFF.
+    0x10058313, // 20: addi t1, a1, 256
+    0xfff00e93, //    li t4, -1
+    0x006f7863, // 21: bgeu t5, t1, 19f
+    0x01df0023, //    sb t4, 0(t5)
+    0x001f0f13, //    addi t5, t5, 1
+    0xff5ff06f, //    j 21b
+    0x02089463, // 19: bnez a7, 7f
+    // Fast page erase: CTLR = FTER, ADDR = page, CTLR = FTER | STRT, wait while STATR.BUSY.
+    0x000203b7, //    lui t2, 0x20
+    0x0072a823, //    sw t2, 0x10(t0)
+    0x00a2aa23, //    sw a0, 0x14(t0)
+    0x0403ee13, //    ori t3, t2, 0x40
+    0x01c2a823, //    sw t3, 0x10(t0)
+    0x00c2a303, // 4: lw t1, 0x0C(t0)
+    0x00137313, //    andi t1, t1, 1
+    0xfe031ce3, //    bnez t1, 4b
+    0x04058263, //    beqz a1, 8f
+    // Fast page program: CTLR = FTPG, ADDR = page, fill the page buffer word by word.
+    0x000103b7, // 7: lui t2, 0x10
+    0x0072a823, //    sw t2, 0x10(t0)
+    0x00a2aa23, //    sw a0, 0x14(t0)
+    0x00050e93, //    mv t4, a0
+    0x00058f13, //    mv t5, a1
+    0x10058f93, //    addi t6, a1, 256
+    0x000f2303, // 5: lw t1, 0(t5)
+    0x006ea023, //    sw t1, 0(t4)
+    0x00c2a303, // 6: lw t1, 0x0C(t0)
+    0x00237313, //    andi t1, t1, 2
+    0xfe031ce3, //    bnez t1, 6b
+    0x004e8e93, //    addi t4, t4, 4
+    0x004f0f13, //    addi t5, t5, 4
+    0xffff12e3, //    bne t5, t6, 5b
+    // CTLR = FTPG | PGSTRT and return while the page programs.
+    0x00210e37, //    lui t3, 0x210
+    0x01c2a823, //    sw t3, 0x10(t0)
+    0x00000513, // 8: li a0, 0
+    0x00100073, //    ebreak
+    0x000e8513, // 9: mv a0, t4
+    0x00100073, //    ebreak
+};
+
+// An abstract command is still running.
+#define CH32_ABSTRACTCS_BUSY   (1 << 12)
+// Command error field of ABSTRACTCS, write ones to clear.
+#define CH32_ABSTRACTCS_CMDERR (0b111 << 8)
+// Re-execute the last command on every access to DATA0.
+#define CH32_ABSTRACTAUTO_DATA0 (1 << 0)
+
+typedef struct ch32_variant {
+    uint16_t    id;            // Upper half-word of the chip ID.
+    char const *name;
+    uint16_t    flash_kib;     // Used when the flash size register reads blank.
+    uint16_t    zero_wait_kib;
+} ch32_variant_t;
+
+static ch32_variant_t const ch32_variants[] = {
+    {0x2030, "CH32V203C8U6", 64, 64},   {0x2031, "CH32V203C8T6", 64, 64},   {0x2032, "CH32V203K8T6", 64, 64},
+    {0x2033, "CH32V203C6T6", 32, 32},   {0x2034, "CH32V203RBT6", 128, 128}, {0x2035, "CH32V203K6T6", 32, 32},
+    {0x2036, "CH32V203G6U6", 32, 32},   {0x2037, "CH32V203F6P6", 32, 32},   {0x2039, "CH32V203F6P6", 32, 32},
+    {0x203A, "CH32V203F8P6", 64, 64},   {0x203B, "CH32V203G8R6", 64, 64},   {0x203E, "CH32V203F8U6", 64, 64},
+    {0x2080, "CH32V208WBU6", 128, 128}, {0x2081, "CH32V208RBT6", 128, 128}, {0x2082, "CH32V208CBU6", 128, 128},
+    {0x2083, "CH32V208GBU6", 128, 128},
+};
+
+// The hart runs code of its own or is reset, nothing cached about the debug module state holds after this.
+static void ch32_invalidate_caches(rvswd_handle_t *handle) {
+    rvswd_progbuf_invalidate(handle);
+    rvswd_gpr_invalidate(handle);
+}
+
+// Timeout, yield time and statistics of each kind of wait.
+static struct {
+    uint32_t          timeout_us;
+    uint32_t          yield_us;
+    ch32_wait_stats_t stats;
+} ch32_waits[CH32_WAIT_COUNT] = {
+    [CH32_WAIT_FLASH]  = {.timeout_us = 500000, .yield_us = 5000},
+    [CH32_WAIT_HALT]   = {.timeout_us = 50000, .yield_us = 1000},
+    [CH32_WAIT_RESUME] = {.timeout_us = 50000, .yield_us = 1000},
+    [CH32_WAIT_RESET]  = {.timeout_us = 50000, .yield_us = 1000},
+    [CH32_WAIT_RUN]    = {.timeout_us = 50000, .yield_us = 1000},
+    [CH32_WAIT_LOADER] = {.timeout_us = CH32_LOADER_TIMEOUT_US, .yield_us = 5000},
+};
+
+// Shared by all handles and jobs, so ch32_waits is only accessed with this held.
+static portMUX_TYPE ch32_waits_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct ch32_waiter {
+    ch32_wait_op_t op;
+    int64_t        start;
+    uint32_t       timeout_us; // Taken from ch32_waits when the wait begins.
+    uint32_t       yield_us;
+    uint32_t       backoff_us;
+    uint32_t       polls;
+    bool           yielded;
+    bool           timed_out;
+} ch32_waiter_t;
+
+void ch32_wait_configure(ch32_wait_op_t op, uint32_t timeout_us, uint32_t yield_us) {
+    taskENTER_CRITICAL(&ch32_waits_lock);
+    ch32_waits[op].timeout_us = timeout_us;
+    ch32_waits[op].yield_us   = yield_us;
+    taskEXIT_CRITICAL(&ch32_waits_lock);
+}
+
+void ch32_wait_statistics(ch32_wait_op_t op, ch32_wait_stats_t *stats, bool reset) {
+    taskENTER_CRITICAL(&ch32_waits_lock);
+    *stats = ch32_waits[op].stats;
+    if (reset) {
+        memset(&ch32_waits[op].stats, 0, sizeof(ch32_wait_stats_t));
+    }
+    taskEXIT_CRITICAL(&ch32_waits_lock);
+}
+
+static void ch32_wait_begin(ch32_waiter_t *waiter, ch32_wait_op_t op) {
+    memset(waiter, 0, sizeof(ch32_waiter_t));
+    waiter->op = op;
+    taskENTER_CRITICAL(&ch32_waits_lock);
+    waiter->timeout_us = ch32_waits[op].timeout_us;
+    waiter->yield_us   = ch32_waits[op].yield_us;
+    taskEXIT_CRITICAL(&ch32_waits_lock);
+    waiter->start = esp_timer_get_time();
+}
+
+// Call after a status read showed the operation is still going on. Returns false once the wait timed
+// out, otherwise delays until the next poll.
+static bool ch32_wait_continue(ch32_waiter_t *waiter) {
+    int64_t elapsed = esp_timer_get_time() - waiter->start;
+    waiter->polls++;
+    if (elapsed >= waiter->timeout_us) {
+        waiter->timed_out = true;
+        return false;
+    }
+    if (elapsed >= waiter->yield_us) {
+        waiter->yielded = true;
+        vTaskDelay(1);
+    } else if (waiter->backoff_us == 0) {
+        // Poll again at once first, a status read over RVSWD takes a while by itself.
+        waiter->backoff_us = CH32_WAIT_BACKOFF_MIN_US;
+    } else {
+        esp_rom_delay_us(waiter->backoff_us);
+        if (waiter->backoff_us < CH32_WAIT_BACKOFF_MAX_US) {
+            waiter->backoff_us *= 2;
+        }
+    }
+    return true;
+}
+
+// Record the wait in the statistics, returns false when it timed out.
+static bool ch32_wait_end(ch32_waiter_t *waiter) {
+    int64_t elapsed = esp_timer_get_time() - waiter->start;
+
+    taskENTER_CRITICAL(&ch32_waits_lock);
+    ch32_wait_stats_t *stats = &ch32_waits[waiter->op].stats;
+    stats->waits++;
+    stats->polls    += waiter->polls + !waiter->timed_out;
+    stats->yields   += waiter->yielded;
+    stats->timeouts += waiter->timed_out;
+    stats->total_us += elapsed;
+    if (elapsed > stats->max_us) {
+        stats->max_us = elapsed;
+    }
+    taskEXIT_CRITICAL(&ch32_waits_lock);
+    return !waiter->timed_out;
+}
+
 rvswd_result_t ch32_halt_microprocessor(rvswd_handle_t *handle) {
+    ch32_invalidate_caches(handle);
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Make the debug module work properly
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Initiate a halt request
 
     // Get the debug module status information, check rdata[9:8], if the value is 0b11,
     // it means the processor enters the halt state normally. Otherwise try again.
-    uint8_t timeout = 5;
-    while (1) {
-        uint32_t value;
+    ch32_waiter_t waiter;
+    uint32_t      value = 0;
+    ch32_wait_begin(&waiter, CH32_WAIT_HALT);
+    do {
         rvswd_read(handle, CH32_REG_DEBUG_DMSTATUS, &value);
-        if (((value >> 8) & 0b11) == 0b11) { // Check that processor has entered halted state
-            break;
-        }
-        if (timeout == 0) {
-            ESP_LOGE(TAG, "Failed to halt microprocessor, DMSTATUS=%" PRIx32, value);
-            return false;
-        }
-        timeout--;
-        vTaskDelay(pdMS_TO_TICKS(10));
+    } while (((value >> 8) & 0b11) != 0b11 && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Failed to halt microprocessor, DMSTATUS=%" PRIx32, value);
+        return RVSWD_FAIL;
     }
 
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the halt request
@@ -113,6 +441,7 @@ rvswd_result_t ch32_halt_microprocessor(rvswd_handle_t *handle) {
 }
 
 rvswd_result_t ch32_resume_microprocessor(rvswd_handle_t *handle) {
+    ch32_invalidate_caches(handle);
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Make the debug module work properly
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Initiate a halt request
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the halt request
@@ -120,79 +449,107 @@ rvswd_result_t ch32_resume_microprocessor(rvswd_handle_t *handle) {
 
     // Get the debug module status information, check rdata[17:16],
     // if the value is 0b11, it means the processor has recovered.
-    uint8_t timeout = 5;
-    while (1) {
-        uint32_t value;
+    ch32_waiter_t waiter;
+    uint32_t      value = 0;
+    ch32_wait_begin(&waiter, CH32_WAIT_RESUME);
+    do {
         rvswd_read(handle, CH32_REG_DEBUG_DMSTATUS, &value);
-        if ((((value >> 10) & 0b11) == 0b11)) {
-            break;
-        }
-        if (timeout == 0) {
-            ESP_LOGE(TAG, "Failed to resume microprocessor, DMSTATUS=%" PRIx32, value);
-            return RVSWD_FAIL;
-        }
-        timeout--;
-        vTaskDelay(pdMS_TO_TICKS(10));
+    } while (((value >> 10) & 0b11) != 0b11 && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Failed to resume microprocessor, DMSTATUS=%" PRIx32, value);
+        return RVSWD_FAIL;
     }
     return RVSWD_OK;
 }
 
-rvswd_result_t ch32_reset_microprocessor_and_run(rvswd_handle_t *handle) {
-    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Make the debug module work properly
-    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Initiate a halt request
-    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the halt request
+// Reset the hart and wait until it runs, optionally halting it first as the WCH tools do.
+static rvswd_result_t ch32_reset_and_run(rvswd_handle_t *handle, bool halt_first) {
+    ch32_invalidate_caches(handle);
+    if (halt_first) {
+        rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Make the debug module work properly
+        rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x80000001); // Initiate a halt request
+        rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the halt request
+    }
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000003); // Initiate a core reset request
 
-    uint8_t timeout = 5;
-    while (1) {
-        uint32_t value;
+    // Check that processor has been reset, rdata[19:18].
+    ch32_waiter_t waiter;
+    uint32_t      value = 0;
+    ch32_wait_begin(&waiter, CH32_WAIT_RESET);
+    do {
         rvswd_read(handle, CH32_REG_DEBUG_DMSTATUS, &value);
-        if (((value >> 18) & 0b11) == 0b11) { // Check that processor has been reset
-            break;
-        }
-        if (timeout == 0) {
-            ESP_LOGE(TAG, "Failed to reset microprocessor");
-            return RVSWD_FAIL;
-        }
-        timeout--;
-        vTaskDelay(pdMS_TO_TICKS(10));
+    } while (((value >> 18) & 0b11) != 0b11 && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Failed to reset microprocessor, DMSTATUS=%" PRIx32, value);
+        return RVSWD_FAIL;
     }
 
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the core reset request
-    vTaskDelay(pdMS_TO_TICKS(10));
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x10000001); // Clear the core reset status signal
-    vTaskDelay(pdMS_TO_TICKS(10));
     rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the core reset status signal clear request
-    vTaskDelay(pdMS_TO_TICKS(10));
 
+    // Done once the reset status is cleared, rdata[19:18], and the processor runs, rdata[11:10].
+    ch32_wait_begin(&waiter, CH32_WAIT_RUN);
+    do {
+        rvswd_read(handle, CH32_REG_DEBUG_DMSTATUS, &value);
+    } while ((((value >> 18) & 0b11) != 0 || ((value >> 10) & 0b11) != 0b11) && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Microprocessor not running after reset, DMSTATUS=%" PRIx32, value);
+        return RVSWD_FAIL;
+    }
     return RVSWD_OK;
 }
 
-bool ch32_write_cpu_reg(rvswd_handle_t *handle, uint16_t regno, uint32_t value) {
+rvswd_result_t ch32_reset_microprocessor_and_run(rvswd_handle_t *handle) {
+    return ch32_reset_and_run(handle, true);
+}
+
+// Reset straight away, without the halt request and its release before the reset. Only for a target
+// whose debug module is already active, such as right after programming it.
+static rvswd_result_t ch32_restart_microprocessor(rvswd_handle_t *handle) {
+    return ch32_reset_and_run(handle, false);
+}
+
+// Largest number of register accesses queued by a single debug operation.
+#define CH32_BATCH_SIZE 16
+
+// Writes of a GPR that already holds `value` are skipped.
+static void ch32_queue_write_cpu_reg(rvswd_handle_t *handle, rvswd_batch_t *batch, uint16_t regno, uint32_t value) {
+    rvswd_gpr_cache_t *cache = &handle->gpr;
+    bool               gpr   = regno >= CH32_REGS_GPR && regno < CH32_REGS_GPR + 32;
+    if (gpr) {
+        uint32_t bit = 1UL << (regno - CH32_REGS_GPR);
+        if ((cache->valid & bit) && cache->values[regno - CH32_REGS_GPR] == value) {
+            cache->writes_saved++;
+            return;
+        }
+        cache->values[regno - CH32_REGS_GPR] = value;
+        cache->valid |= bit;
+    }
+
     uint32_t command = regno        // Register to access.
                        | (1 << 16)  // Write access.
                        | (1 << 17)  // Perform transfer.
                        | (2 << 20)  // 32-bit register access.
                        | (0 << 24); // Access register command.
 
-    rvswd_write(handle, CH32_REG_DEBUG_DATA0, value);
-    rvswd_write(handle, CH32_REG_DEBUG_COMMAND, command);
-    return true;
+    rvswd_batch_write(batch, CH32_REG_DEBUG_DATA0, value);
+    rvswd_batch_write(batch, CH32_REG_DEBUG_COMMAND, command);
 }
 
-bool ch32_read_cpu_reg(rvswd_handle_t *handle, uint16_t regno, uint32_t *value_out) {
+static void ch32_queue_read_cpu_reg(rvswd_batch_t *batch, uint16_t regno, uint32_t *value_out) {
     uint32_t command = regno        // Register to access.
                        | (0 << 16)  // Read access.
                        | (1 << 17)  // Perform transfer.
                        | (2 << 20)  // 32-bit register access.
                        | (0 << 24); // Access register command.
 
-    rvswd_write(handle, CH32_REG_DEBUG_COMMAND, command);
-    rvswd_read(handle, CH32_REG_DEBUG_DATA0, value_out);
-    return true;
+    rvswd_batch_write(batch, CH32_REG_DEBUG_COMMAND, command);
+    rvswd_batch_read(batch, CH32_REG_DEBUG_DATA0, value_out);
 }
 
-bool ch32_run_debug_code(rvswd_handle_t *handle, void const *code, size_t code_size) {
+// Only PROGBUF registers whose content differs from what the handle last loaded are rewritten.
+static bool ch32_queue_progbuf(rvswd_handle_t *handle, rvswd_batch_t *batch, void const *code, size_t code_size) {
     if (code_size > 8 * 4) {
         ESP_LOGE(TAG, "Debug program is too long (%zd/%zd)", code_size, (size_t)8 * 4);
         return false;
@@ -204,8 +561,25 @@ bool ch32_run_debug_code(rvswd_handle_t *handle, void const *code, size_t code_s
     // Copy into program buffer.
     uint32_t tmp[8] = {0};
     memcpy(tmp, code, code_size);
+    rvswd_progbuf_cache_t *cache = &handle->progbuf;
     for (size_t i = 0; i < 8; i++) {
-        rvswd_write(handle, CH32_REG_DEBUG_PROGBUF0 + i, tmp[i]);
+        if ((cache->valid & (1 << i)) && cache->words[i] == tmp[i]) {
+            cache->writes_saved++;
+            continue;
+        }
+        rvswd_batch_write(batch, CH32_REG_DEBUG_PROGBUF0 + i, tmp[i]);
+        cache->words[i] = tmp[i];
+        cache->valid |= 1 << i;
+    }
+
+    return true;
+}
+
+// `clobbers` is the mask of GPRs the code modifies, which are dropped from the register cache.
+static bool ch32_queue_debug_code(rvswd_handle_t *handle, rvswd_batch_t *batch, void const *code, size_t code_size,
+                                  uint32_t clobbers) {
+    if (!ch32_queue_progbuf(handle, batch, code, code_size)) {
+        return false;
     }
 
     // Run program buffer.
@@ -213,42 +587,362 @@ bool ch32_run_debug_code(rvswd_handle_t *handle, void const *code, size_t code_s
                        | (1 << 18)  // Run program buffer afterwards.
                        | (2 << 20)  // 32-bit register access.
                        | (0 << 24); // Access register command.
-    rvswd_write(handle, CH32_REG_DEBUG_COMMAND, command);
+    rvswd_batch_write(batch, CH32_REG_DEBUG_COMMAND, command);
+    handle->gpr.valid &= ~clobbers;
+
+    return true;
+}
+
+// Submit a batch, dropping the caches when they may no longer match the debug module.
+static bool ch32_submit(rvswd_handle_t *handle, rvswd_batch_t *batch) {
+    if (rvswd_batch_submit(handle, batch) != RVSWD_OK) {
+        ch32_invalidate_caches(handle);
+        return false;
+    }
+    return true;
+}
+
+bool ch32_write_cpu_reg(rvswd_handle_t *handle, uint16_t regno, uint32_t value) {
+    rvswd_op_t    ops[2];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, 2);
+    ch32_queue_write_cpu_reg(handle, &batch, regno, value);
+    return ch32_submit(handle, &batch);
+}
 
+bool ch32_read_cpu_reg(rvswd_handle_t *handle, uint16_t regno, uint32_t *value_out) {
+    rvswd_op_t    ops[2];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, 2);
+    ch32_queue_read_cpu_reg(&batch, regno, value_out);
+    if (!ch32_submit(handle, &batch)) {
+        return false;
+    }
+    if (regno >= CH32_REGS_GPR && regno < CH32_REGS_GPR + 32) {
+        handle->gpr.values[regno - CH32_REGS_GPR] = *value_out;
+        handle->gpr.valid |= 1UL << (regno - CH32_REGS_GPR);
+    }
     return true;
 }
 
+bool ch32_run_debug_code(rvswd_handle_t *handle, void const *code, size_t code_size) {
+    rvswd_op_t    ops[9];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, 9);
+    // Arbitrary code, assume it modifies every register.
+    if (!ch32_queue_debug_code(handle, &batch, code, code_size, UINT32_MAX)) {
+        return false;
+    }
+    return ch32_submit(handle, &batch);
+}
+
+// Memory accesses are queued as a single batch so transports can send the frames back-to-back.
 bool ch32_read_memory_word(rvswd_handle_t *handle, uint32_t address, uint32_t *value_out) {
-    ch32_write_cpu_reg(handle, CH32_REGS_GPR + 11, address);
-    ch32_run_debug_code(handle, ch32_readmem, sizeof(ch32_readmem));
-    ch32_read_cpu_reg(handle, CH32_REGS_GPR + 10, value_out);
+    rvswd_op_t    ops[CH32_BATCH_SIZE];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, CH32_BATCH_SIZE);
+    ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 11, address);
+    ch32_queue_debug_code(handle, &batch, ch32_readmem, sizeof(ch32_readmem), CH32_READMEM_CLOBBERS);
+    ch32_queue_read_cpu_reg(&batch, CH32_REGS_GPR + 10, value_out);
+    if (!ch32_submit(handle, &batch)) {
+        return false;
+    }
+    handle->gpr.values[10] = *value_out;
+    handle->gpr.valid |= 1UL << 10;
     return true;
 }
 
 bool ch32_write_memory_word(rvswd_handle_t *handle, uint32_t address, uint32_t value) {
-    ch32_write_cpu_reg(handle, CH32_REGS_GPR + 10, value);
-    ch32_write_cpu_reg(handle, CH32_REGS_GPR + 11, address);
-    ch32_run_debug_code(handle, ch32_writemem, sizeof(ch32_writemem));
+    rvswd_op_t    ops[CH32_BATCH_SIZE];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, CH32_BATCH_SIZE);
+    ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 10, value);
+    ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 11, address);
+    ch32_queue_debug_code(handle, &batch, ch32_writemem, sizeof(ch32_writemem), CH32_WRITEMEM_CLOBBERS);
+    return ch32_submit(handle, &batch);
+}
+
+// Number of register accesses submitted at a time while streaming a block.
+#define CH32_BLOCK_BATCH_SIZE 32
+
+// Write `count` words to consecutive addresses starting at `address`, running `code` after each
+// transfer into a0. The snippet is loaded once and DATA0 is set to auto-execute a write of a0
+// followed by the snippet, so every word after the first costs a single DATA0 write.
+static bool ch32_write_words(rvswd_handle_t *handle, uint32_t address, uint32_t const *words, size_t count,
+                             uint8_t const *code, size_t code_size, uint32_t clobbers) {
+    uint32_t command = (CH32_REGS_GPR + 10) // Register to access.
+                       | (1 << 16)          // Write access.
+                       | (1 << 17)          // Perform transfer.
+                       | (1 << 18)          // Run program buffer afterwards.
+                       | (2 << 20)          // 32-bit register access.
+                       | (0 << 24);         // Access register command.
+
+    rvswd_op_t    ops[CH32_BLOCK_BATCH_SIZE];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, CH32_BLOCK_BATCH_SIZE);
+    ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 11, address);
+    if (code == ch32_writemem_flash) {
+        ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 12, CH32_FLASH_STATR);
+    }
+    ch32_queue_progbuf(handle, &batch, code, code_size);
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_DATA0, words[0]);
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_COMMAND, command);
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_ABSTRACTAUTO, CH32_ABSTRACTAUTO_DATA0);
+    handle->gpr.valid &= ~(clobbers | (1 << 10));
+
+    for (size_t i = 1; i < count; i++) {
+        if (batch.count == batch.capacity && !ch32_submit(handle, &batch)) {
+            return false;
+        }
+        rvswd_batch_write(&batch, CH32_REG_DEBUG_DATA0, words[i]);
+    }
+
+    uint32_t abstractcs = 0;
+    if (batch.count + 2 > batch.capacity && !ch32_submit(handle, &batch)) {
+        return false;
+    }
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_ABSTRACTAUTO, 0);
+    rvswd_batch_read(&batch, CH32_REG_DEBUG_ABSTRACTCS, &abstractcs);
+    if (!ch32_submit(handle, &batch)) {
+        return false;
+    }
+
+    if (abstractcs & CH32_ABSTRACTCS_CMDERR) {
+        ESP_LOGE(TAG, "Block write at %08" PRIx32 " failed, ABSTRACTCS=%08" PRIx32, address, abstractcs);
+        rvswd_write(handle, CH32_REG_DEBUG_ABSTRACTCS, CH32_ABSTRACTCS_CMDERR);
+        ch32_invalidate_caches(handle);
+        return false;
+    }
+
+    handle->gpr.values[10] = words[count - 1];
+    handle->gpr.values[11] = address + count * 4;
+    handle->gpr.valid |= (1 << 10) | (1 << 11);
     return true;
 }
 
-// Wait for the FLASH chip to finish its current operation.
-static void ch32_wait_flash(rvswd_handle_t *handle) {
-    uint32_t value = 0;
-    ch32_read_memory_word(handle, CH32_FLASH_STATR, &value);
+bool ch32_write_memory_block(rvswd_handle_t *handle, uint32_t address, uint32_t const *words, size_t count) {
+    if (count == 0) {
+        return true;
+    }
+    return ch32_write_words(handle, address, words, count, ch32_writemem_inc, sizeof(ch32_writemem_inc),
+                            CH32_WRITEMEM_INC_CLOBBERS);
+}
 
-    while (value & CH32_FLASH_STATR_BUSY) {
-        vTaskDelay(1);
-        ch32_read_memory_word(handle, CH32_FLASH_STATR, &value);
+// Load a page into the fast programming buffer, each store waiting on the target for WRBUSY to
+// clear as the reference manual requires. Should a store still be waiting when the next word
+// arrives, the debug module reports the command as busy and the block write fails.
+static bool ch32_write_flash_buffer(rvswd_handle_t *handle, uint32_t address, uint32_t const *words, size_t count) {
+    return ch32_write_words(handle, address, words, count, ch32_writemem_flash, sizeof(ch32_writemem_flash),
+                            CH32_WRITEMEM_FLASH_CLOBBERS);
+}
+
+// Read `count` words from consecutive addresses starting at `address`. The load-and-increment
+// snippet always runs one word ahead of the transfer of a0 into DATA0, so with DATA0 set to
+// auto-execute both, every read of DATA0 returns a word and fetches the next. Auto-execution is
+// stopped before the snippet would run past the end of the block.
+bool ch32_read_memory_block(rvswd_handle_t *handle, uint32_t address, uint32_t *out, size_t count) {
+    if (count == 0) {
+        return true;
+    } else if (count == 1) {
+        return ch32_read_memory_word(handle, address, out);
+    }
+
+    uint32_t run = (0 << 17)    // Do not perform transfer.
+                   | (1 << 18)  // Run program buffer afterwards.
+                   | (2 << 20)  // 32-bit register access.
+                   | (0 << 24); // Access register command.
+
+    uint32_t transfer_and_run = (CH32_REGS_GPR + 10) // Register to access.
+                                | (0 << 16)          // Read access.
+                                | (1 << 17)          // Perform transfer.
+                                | (1 << 18)          // Run program buffer afterwards.
+                                | (2 << 20)          // 32-bit register access.
+                                | (0 << 24);         // Access register command.
+
+    rvswd_op_t    ops[CH32_BLOCK_BATCH_SIZE];
+    rvswd_batch_t batch;
+    rvswd_batch_init(&batch, ops, CH32_BLOCK_BATCH_SIZE);
+    ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 11, address);
+    ch32_queue_progbuf(handle, &batch, ch32_readmem_inc, sizeof(ch32_readmem_inc));
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_COMMAND, run);              // a0 = word 0
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_COMMAND, transfer_and_run); // DATA0 = word 0, a0 = word 1
+    handle->gpr.valid &= ~CH32_READMEM_INC_CLOBBERS;
+
+    if (count > 2) {
+        rvswd_batch_write(&batch, CH32_REG_DEBUG_ABSTRACTAUTO, CH32_ABSTRACTAUTO_DATA0);
+        for (size_t i = 0; i < count - 2; i++) {
+            if (batch.count == batch.capacity && !ch32_submit(handle, &batch)) {
+                return false;
+            }
+            rvswd_batch_read(&batch, CH32_REG_DEBUG_DATA0, &out[i]);
+        }
+    }
+
+    uint32_t abstractcs = 0;
+    if (batch.count + 5 > batch.capacity && !ch32_submit(handle, &batch)) {
+        return false;
+    }
+    rvswd_batch_write(&batch, CH32_REG_DEBUG_ABSTRACTAUTO, 0);
+    rvswd_batch_read(&batch, CH32_REG_DEBUG_DATA0, &out[count - 2]);
+    ch32_queue_read_cpu_reg(&batch, CH32_REGS_GPR + 10, &out[count - 1]);
+    rvswd_batch_read(&batch, CH32_REG_DEBUG_ABSTRACTCS, &abstractcs);
+    if (!ch32_submit(handle, &batch)) {
+        return false;
     }
+
+    if (abstractcs & CH32_ABSTRACTCS_CMDERR) {
+        ESP_LOGE(TAG, "Block read at %08" PRIx32 " failed, ABSTRACTCS=%08" PRIx32, address, abstractcs);
+        rvswd_write(handle, CH32_REG_DEBUG_ABSTRACTCS, CH32_ABSTRACTCS_CMDERR);
+        ch32_invalidate_caches(handle);
+        return false;
+    }
+
+    handle->gpr.values[10] = out[count - 1];
+    handle->gpr.values[11] = address + count * 4;
+    handle->gpr.valid |= (1 << 10) | (1 << 11);
+    return true;
 }
 
-static void ch32_wait_flash_write(rvswd_handle_t *handle) {
-    uint32_t value = 0;
-    ch32_read_memory_word(handle, CH32_FLASH_STATR, &value);
-    while (value & CH32_FLASH_STATR_WRBUSY) {
+// CRC32 as computed by the CH32 CRC unit: polynomial 0x04C11DB7, MSB first, one word at a time.
+uint32_t ch32_crc32(uint32_t crc, uint32_t const *words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        crc ^= words[i];
+        for (uint8_t bit = 0; bit < 32; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Words fed to the CRC unit per program buffer run, keeping each abstract command short.
+#define CH32_CRC_CHUNK_WORDS 64
+
+// Let the target's CRC unit compute the CRC32 of `count` words starting at `address`. The words are
+// fed to the unit by a loop running from the program buffer, so only the result crosses the wire.
+bool ch32_crc_memory(rvswd_handle_t *handle, uint32_t address, size_t count, uint32_t *crc_out) {
+    if (count == 0 || !ch32_write_memory_word(handle, CH32_CRC_CTLR, CH32_CRC_CTLR_RESET)) {
+        return false;
+    }
+
+    for (size_t offset = 0; offset < count; offset += CH32_CRC_CHUNK_WORDS) {
+        size_t chunk = (count - offset < CH32_CRC_CHUNK_WORDS) ? count - offset : CH32_CRC_CHUNK_WORDS;
+
+        uint32_t      abstractcs = 0;
+        rvswd_op_t    ops[CH32_BATCH_SIZE];
+        rvswd_batch_t batch;
+        rvswd_batch_init(&batch, ops, CH32_BATCH_SIZE);
+        ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 11, address + offset * 4);
+        ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 12, CH32_CRC_DATAR);
+        ch32_queue_write_cpu_reg(handle, &batch, CH32_REGS_GPR + 14, chunk);
+        ch32_queue_debug_code(handle, &batch, ch32_crcmem, sizeof(ch32_crcmem), CH32_CRCMEM_CLOBBERS);
+        rvswd_batch_read(&batch, CH32_REG_DEBUG_ABSTRACTCS, &abstractcs);
+        if (!ch32_submit(handle, &batch)) {
+            return false;
+        }
+
+        // The loop may still be running, further commands would fail with a busy error.
+        for (uint8_t timeout = 100; abstractcs & CH32_ABSTRACTCS_BUSY; timeout--) {
+            if (timeout == 0) {
+                ESP_LOGE(TAG, "CRC of %08" PRIx32 " timed out", address);
+                return false;
+            }
+            rvswd_read(handle, CH32_REG_DEBUG_ABSTRACTCS, &abstractcs);
+        }
+        if (abstractcs & CH32_ABSTRACTCS_CMDERR) {
+            ESP_LOGE(TAG, "CRC of %08" PRIx32 " failed, ABSTRACTCS=%08" PRIx32, address, abstractcs);
+            rvswd_write(handle, CH32_REG_DEBUG_ABSTRACTCS, CH32_ABSTRACTCS_CMDERR);
+            ch32_invalidate_caches(handle);
+            return false;
+        }
+
+        // The loop leaves a1 just past the words it fed to the unit.
+        handle->gpr.values[11] = address + (offset + chunk) * 4;
+        handle->gpr.valid |= 1 << 11;
+    }
+
+    return ch32_read_memory_word(handle, CH32_CRC_DATAR, crc_out);
+}
+
+// Enable the CRC unit and check that it computes the same CRC as ch32_crc32 on a few words of flash.
+bool ch32_crc_init(rvswd_handle_t *handle) {
+    uint32_t ahbpcenr;
+    if (!ch32_read_memory_word(handle, CH32_RCC_AHBPCENR, &ahbpcenr) ||
+        !ch32_write_memory_word(handle, CH32_RCC_AHBPCENR, ahbpcenr | CH32_RCC_AHBPCENR_CRCEN)) {
+        return false;
+    }
+
+    uint32_t words[4];
+    uint32_t crc;
+    if (!ch32_read_memory_block(handle, CH32_CODE_BEGIN, words, 4) || !ch32_crc_memory(handle, CH32_CODE_BEGIN, 4, &crc)) {
+        return false;
+    }
+    return crc == ch32_crc32(0xFFFFFFFF, words, 4);
+}
+
+// Read the chip ID and flash size register and cache the part's flash geometry on the handle.
+bool ch32_probe(rvswd_handle_t *handle) {
+    uint32_t chip_id, flash_kib;
+    if (!ch32_read_memory_word(handle, CH32_CHIP_ID_REG, &chip_id) ||
+        !ch32_read_memory_word(handle, CH32_FLASH_SIZE_REG, &flash_kib)) {
+        return false;
+    }
+    flash_kib &= 0xFFFF;
+
+    ch32_variant_t const *variant = NULL;
+    for (size_t i = 0; i < sizeof(ch32_variants) / sizeof(ch32_variants[0]); i++) {
+        if (ch32_variants[i].id == chip_id >> 16) {
+            variant = &ch32_variants[i];
+            break;
+        }
+    }
+    if (flash_kib == 0 || flash_kib == 0xFFFF) {
+        if (variant == NULL) {
+            ESP_LOGE(TAG, "Unknown chip ID %08" PRIx32 " and no flash size", chip_id);
+            return false;
+        }
+        flash_kib = variant->flash_kib;
+    }
+
+    rvswd_target_t *target = &handle->target;
+    target->chip_id        = chip_id;
+    target->name           = variant ? variant->name : NULL;
+    target->flash_base     = CH32_CODE_BEGIN;
+    target->flash_size     = flash_kib * 1024;
+    target->zero_wait_size = variant && variant->zero_wait_kib < flash_kib ? variant->zero_wait_kib * 1024
+                                                                           : target->flash_size;
+    target->page_size      = CH32_FLASH_PAGE_SIZE;
+    target->sector_size    = CH32_FLASH_SECTOR_SIZE;
+
+    ESP_LOGI(TAG, "Target %s (chip ID %08" PRIx32 "), %" PRIu32 " KiB flash, %" PRIu32 " KiB zero-wait",
+             target->name ? target->name : "unknown", chip_id, target->flash_size / 1024,
+             target->zero_wait_size / 1024);
+    return true;
+}
+
+// Check that a range lies within flash, limited to the smallest part until ch32_probe succeeded.
+static bool ch32_flash_range_valid(rvswd_handle_t *handle, uint32_t addr, size_t len) {
+    uint32_t size = handle->target.flash_size ? handle->target.flash_size : CH32_CODE_MIN_SIZE;
+    return addr >= CH32_CODE_BEGIN && addr - CH32_CODE_BEGIN <= size && len <= size - (addr - CH32_CODE_BEGIN);
+}
+
+// Wait for FLASH to clear the `busy` bits of STATR, returns false on timeout.
+static bool ch32_wait_flash_status(rvswd_handle_t *handle, uint32_t busy) {
+    ch32_waiter_t waiter;
+    uint32_t      value = 0;
+    ch32_wait_begin(&waiter, CH32_WAIT_FLASH);
+    do {
         ch32_read_memory_word(handle, CH32_FLASH_STATR, &value);
+    } while ((value & busy) && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Flash busy, STATR=%" PRIx32, value);
+        return false;
     }
+    return true;
+}
+
+// Wait for the FLASH chip to finish its current operation.
+static bool ch32_wait_flash(rvswd_handle_t *handle) {
+    return ch32_wait_flash_status(handle, CH32_FLASH_STATR_BUSY);
 }
 
 // Unlock the FLASH if not already unlocked.
@@ -280,47 +974,99 @@ bool ch32_unlock_flash(rvswd_handle_t *handle) {
     return !(ctlr & 0x8080);
 }
 
+// Flash-busy time estimates of each erase operation in microseconds, used until the handle has
+// measured the operation on its target.
+#define CH32_ERASE_PAGE_US   2000
+#define CH32_ERASE_SECTOR_US 4000
+#define CH32_ERASE_MASS_US   20000
+
+static int64_t ch32_erase_time(uint32_t measured_us, int64_t estimate_us) {
+    return measured_us ? measured_us : estimate_us;
+}
+
+// If unlocked: Run one erase operation, `mode` being FTER, PER or MER, and store the time it took in
+// `elapsed_us` when it succeeded.
+static bool ch32_erase(rvswd_handle_t *handle, uint32_t mode, uint32_t addr, uint32_t *elapsed_us) {
+    if (!ch32_wait_flash(handle) || !ch32_write_memory_word(handle, CH32_FLASH_CTLR, mode)) {
+        return false;
+    }
+    if (mode != CH32_FLASH_CTLR_MER && !ch32_write_memory_word(handle, CH32_FLASH_ADDR, addr)) {
+        ch32_write_memory_word(handle, CH32_FLASH_CTLR, 0);
+        return false;
+    }
+    int64_t start   = esp_timer_get_time();
+    bool    started = ch32_write_memory_word(handle, CH32_FLASH_CTLR, mode | CH32_FLASH_CTLR_STRT);
+    bool    done    = started && ch32_wait_flash(handle);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (!ch32_write_memory_word(handle, CH32_FLASH_CTLR, 0) || !done) {
+        return false;
+    }
+    *elapsed_us = elapsed;
+    return true;
+}
+
 // If unlocked: Erase a 256-byte block of FLASH.
 bool ch32_erase_flash_block(rvswd_handle_t *handle, uint32_t addr) {
-    if (addr % 256)
+    if (addr % CH32_FLASH_PAGE_SIZE)
         return false;
-    ch32_wait_flash(handle);
-    ch32_write_memory_word(handle, CH32_FLASH_CTLR, CH32_FLASH_CTLR_FTER);
-    ch32_write_memory_word(handle, CH32_FLASH_ADDR, addr);
-    ch32_write_memory_word(handle, CH32_FLASH_CTLR, CH32_FLASH_CTLR_FTER | CH32_FLASH_CTLR_STRT);
-    ch32_wait_flash(handle);
-    ch32_write_memory_word(handle, CH32_FLASH_CTLR, 0);
-    return true;
+    return ch32_erase(handle, CH32_FLASH_CTLR_FTER, addr, &handle->erase_times.page_us);
+}
+
+// If unlocked: Erase a 4 KiB sector of FLASH.
+bool ch32_erase_flash_sector(rvswd_handle_t *handle, uint32_t addr) {
+    if (addr % CH32_FLASH_SECTOR_SIZE)
+        return false;
+    return ch32_erase(handle, CH32_FLASH_CTLR_PER, addr, &handle->erase_times.sector_us);
+}
+
+// If unlocked: Erase all of FLASH.
+bool ch32_erase_flash_mass(rvswd_handle_t *handle) {
+    return ch32_erase(handle, CH32_FLASH_CTLR_MER, 0, &handle->erase_times.mass_us);
 }
 
 // If unlocked: Write a 256-byte block of FLASH.
-bool ch32_write_flash_block(rvswd_handle_t *handle, uint32_t addr, void const *data) {
+bool ch32_write_flash_block(rvswd_handle_t *handle, uint32_t addr, void const *data, ch32_verify_t verify) {
     if (addr % 256)
         return false;
 
-    ch32_wait_flash(handle);
+    if (!ch32_wait_flash(handle)) {
+        return false;
+    }
     ch32_write_memory_word(handle, CH32_FLASH_CTLR, CH32_FLASH_CTLR_FTPG);
 
     ch32_write_memory_word(handle, CH32_FLASH_ADDR, addr);
 
-    uint32_t wdata[64];
-    memcpy(wdata, data, sizeof(wdata));
-    for (size_t i = 0; i < 64; i++) {
-        ch32_write_memory_word(handle, addr + i * 4, wdata[i]);
-        ch32_wait_flash_write(handle);
+    // Pages are used in place, only unaligned ones are copied.
+    uint32_t        copy[64];
+    uint32_t const *wdata = data;
+    if ((uintptr_t)data % sizeof(uint32_t)) {
+        memcpy(copy, data, sizeof(copy));
+        wdata = copy;
+    }
+    if (!ch32_write_flash_buffer(handle, addr, wdata, 64)) {
+        return false;
     }
 
     ch32_write_memory_word(handle, CH32_FLASH_CTLR, CH32_FLASH_CTLR_FTPG | CH32_FLASH_CTLR_PGSTRT);
-    ch32_wait_flash(handle);
+    bool done = ch32_wait_flash(handle);
     ch32_write_memory_word(handle, CH32_FLASH_CTLR, 0);
-    vTaskDelay(1);
+    if (!done) {
+        return false;
+    }
+
+    if (verify == CH32_VERIFY_CRC) {
+        uint32_t crc;
+        if (ch32_crc_memory(handle, addr, 64, &crc) && crc == ch32_crc32(0xFFFFFFFF, wdata, 64)) {
+            return true;
+        }
+        ESP_LOGW(TAG, "CRC mismatch at %08" PRIx32 ", reading back", addr);
+    }
 
     uint32_t rdata[64];
-    for (size_t i = 0; i < 64; i++) {
-        vTaskDelay(0);
-        ch32_read_memory_word(handle, addr + i * 4, &rdata[i]);
+    if (!ch32_read_memory_block(handle, addr, rdata, 64)) {
+        return false;
     }
-    if (memcmp(wdata, rdata, sizeof(wdata))) {
+    if (memcmp(wdata, rdata, sizeof(rdata))) {
         ESP_LOGE(TAG, "Write block mismatch at %08" PRIx32, addr);
         ESP_LOGE(TAG, "Write:");
         for (size_t i = 0; i < 64; i++) {
@@ -336,27 +1082,528 @@ bool ch32_write_flash_block(rvswd_handle_t *handle, uint32_t addr, void const *d
     return true;
 }
 
-// If unlocked: Erase and write a range of FLASH memory.
-bool ch32_write_flash(rvswd_handle_t *handle, uint32_t addr, void const *_data, size_t data_len) {
-    if (addr % 64) {
+// Upload the flash loader to SRAM and prepare the halted hart for running it: ebreak halts the
+// hart instead of trapping and interrupts stay disabled while the loader runs.
+bool ch32_loader_init(rvswd_handle_t *handle) {
+    if (!ch32_write_memory_block(handle, CH32_LOADER_ADDR, ch32_loader, sizeof(ch32_loader) / sizeof(uint32_t))) {
+        ESP_LOGE(TAG, "Failed to upload flash loader");
+        return false;
+    }
+
+    uint32_t dcsr, mstatus;
+    if (!ch32_read_cpu_reg(handle, CH32_REGS_CSR + CH32_CSR_DCSR, &dcsr) ||
+        !ch32_write_cpu_reg(handle, CH32_REGS_CSR + CH32_CSR_DCSR, (dcsr | CH32_DCSR_EBREAKM) & ~CH32_DCSR_STEP) ||
+        !ch32_read_cpu_reg(handle, CH32_REGS_CSR + CH32_CSR_MSTATUS, &mstatus) ||
+        !ch32_write_cpu_reg(handle, CH32_REGS_CSR + CH32_CSR_MSTATUS, mstatus & ~CH32_MSTATUS_MIE)) {
+        return false;
+    }
+    return true;
+}
+
+// Run the loader with the given arguments in a0..a5, wait for it to halt and return its a0.
+// The hart cannot be inspected through the debug module while it runs, so completion is the
+// hart halting on the loader's final ebreak.
+bool ch32_loader_call(rvswd_handle_t *handle, uint32_t const args[CH32_LOADER_ARGS], uint32_t *result) {
+    for (size_t i = 0; i < CH32_LOADER_ARGS; i++) {
+        if (!ch32_write_cpu_reg(handle, CH32_REGS_GPR + 10 + i, args[i])) {
+            return false;
+        }
+    }
+    if (!ch32_write_cpu_reg(handle, CH32_REGS_CSR + CH32_CSR_DPC, CH32_LOADER_ADDR)) {
+        return false;
+    }
+
+    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x40000001); // Initiate a resume request
+    rvswd_gpr_invalidate(handle);
+
+    // Resumed (rdata[17:16]) and halted again (rdata[9:8]).
+    ch32_waiter_t waiter;
+    uint32_t      value = 0;
+    ch32_wait_begin(&waiter, CH32_WAIT_LOADER);
+    do {
+        rvswd_read(handle, CH32_REG_DEBUG_DMSTATUS, &value);
+    } while ((((value >> 16) & 0b11) != 0b11 || ((value >> 8) & 0b11) != 0b11) && ch32_wait_continue(&waiter));
+    if (!ch32_wait_end(&waiter)) {
+        ESP_LOGE(TAG, "Flash loader timed out, DMSTATUS=%" PRIx32, value);
+        ch32_halt_microprocessor(handle);
+        return false;
+    }
+    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001); // Clear the resume request
+
+    return ch32_read_cpu_reg(handle, CH32_REGS_GPR + 10, result);
+}
+
+// What to do with each page of the image, decided before programming starts.
+typedef enum ch32_page_action {
+    CH32_PAGE_WRITE   = 0, // Erase, program and verify.
+    CH32_PAGE_SKIP    = 1, // The target already holds the content.
+    CH32_PAGE_ERASE   = 2, // The page is blank in the image, erasing it is enough.
+    CH32_PAGE_PROGRAM = 3, // Already erased, program and verify.
+} ch32_page_action_t;
+
+// Summary of a page plan.
+typedef struct ch32_plan_stats {
+    size_t skipped; // Pages left alone.
+    size_t erased;  // Blank pages that are only erased.
+} ch32_plan_stats_t;
+
+// Copy page `offset` of an image into `page`, padding a partial last page with the erased value
+// instead of reading past the image.
+static void ch32_stage_page(uint8_t page[256], uint8_t const *data, size_t data_len, size_t offset) {
+    size_t chunk = (data_len - offset < 256) ? data_len - offset : 256;
+    memset(page, 0xFF, 256);
+    memcpy(page, data + offset, chunk);
+}
+
+// An image to program, either in memory or pulled from a reader one page at a time.
+typedef struct ch32_image {
+    uint8_t const *data; // NULL for streamed images.
+    ch32_reader_t  reader;
+    void          *reader_ctx;
+    size_t         len;
+    size_t         position; // Bytes taken from the reader so far.
+    bool           has_crc;  // Whether `crc` holds ch32_crc32 of the image padded to whole pages.
+    uint32_t       crc;
+
+    // Compressed image whose blocks are sent to the loader as they are, to expand on the target.
+    ch32_decompressor_t *packed;
+
+    // Streamed images are planned page by page as they are read.
+    ch32_program_options_t const *options; // NULL writes every page.
+    bool                          use_crc;
+    bool                          erased; // All pages were erased up front.
+
+    ch32_job_t *job; // Receives progress and may cancel between pages, NULL for blocking calls.
+} ch32_image_t;
+
+struct ch32_job {
+    rvswd_handle_t   *handle;
+    void const       *firmware;
+    size_t            firmware_len;
+    ch32_job_config_t config;
+
+    TaskHandle_t              task;
+    SemaphoreHandle_t         finished; // Given once the job's task is done with the job.
+    volatile ch32_job_state_t state;
+    volatile bool             cancel;  // Requested by ch32_job_cancel.
+    bool                      stopped; // The job's task honoured the cancel request.
+};
+
+static void ch32_job_emit(ch32_job_t *job, ch32_job_event_t const *event) {
+    if (job->config.callback) {
+        job->config.callback(event, job->config.callback_ctx);
+    }
+    if (job->config.queue) {
+        xQueueSend(job->config.queue, event, 0);
+    }
+}
+
+// Report progress to the image's job, or to ch32_status_callback for blocking calls.
+static void ch32_report(ch32_image_t const *image, char const *msg, int progress, int total) {
+    if (image->job == NULL) {
+        ch32_status_callback(msg, progress, total);
+        return;
+    }
+    ch32_job_event_t event = {
+        .job      = image->job,
+        .state    = CH32_JOB_RUNNING,
+        .progress = progress,
+        .total    = total,
+    };
+    strlcpy(event.message, msg, sizeof(event.message));
+    ch32_job_emit(image->job, &event);
+}
+
+// Whether to stop at this point because the image's job was cancelled.
+static bool ch32_job_stop(ch32_image_t const *image) {
+    if (image->job == NULL || !image->job->cancel) {
         return false;
     }
+    image->job->stopped = true;
+    return true;
+}
+
+// Read up to `len` bytes from the reader, short only at the end of the image.
+static bool ch32_image_read(ch32_image_t *image, uint8_t *buffer, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        int res = image->reader(image->reader_ctx, buffer + done, len - done);
+        if (res < 0) {
+            ESP_LOGE(TAG, "Failed to read image at %zu", image->position);
+            return false;
+        }
+        if (res == 0) {
+            ESP_LOGE(TAG, "Image ended after %zu of %zu bytes", image->position, image->len);
+            return false;
+        }
+        done            += res;
+        image->position += res;
+    }
+    return true;
+}
+
+// Get the page of the image at `offset`, padded with 0xFF. Whole word-aligned pages of images in
+// memory are used in place, others are staged in `scratch`. Streamed images must be read in
+// ascending order, pages in between are read and dropped. Returns NULL when reading failed.
+static uint32_t const *ch32_image_page(ch32_image_t *image, size_t offset, uint32_t scratch[64]) {
+    uint8_t *page = (uint8_t *)scratch;
+    if (image->data) {
+        if (image->len - offset >= 256 && (uintptr_t)(image->data + offset) % sizeof(uint32_t) == 0) {
+            return (uint32_t const *)(image->data + offset);
+        }
+        ch32_stage_page(page, image->data, image->len, offset);
+        return scratch;
+    }
+    while (image->position < offset) {
+        size_t chunk = (offset - image->position < 256) ? offset - image->position : 256;
+        if (!ch32_image_read(image, page, chunk)) {
+            return NULL;
+        }
+    }
+    if (image->position != offset) {
+        ESP_LOGE(TAG, "Streamed image read out of order at %zu", offset);
+        return NULL;
+    }
+    size_t chunk = (image->len - offset < 256) ? image->len - offset : 256;
+    memset(page, 0xFF, 256);
+    return ch32_image_read(image, page, chunk) ? scratch : NULL;
+}
+
+static bool ch32_page_is_blank(uint32_t const page[64]) {
+    for (size_t i = 0; i < 64; i++) {
+        if (page[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
 
+// Whether the target page holds `page`, compared by CRC when the CRC unit is usable, otherwise by
+// reading it back.
+static bool ch32_page_matches(rvswd_handle_t *handle, uint32_t addr, uint32_t const page[64], bool use_crc) {
+    if (use_crc) {
+        uint32_t crc;
+        return ch32_crc_memory(handle, addr, 64, &crc) && crc == ch32_crc32(0xFFFFFFFF, page, 64);
+    }
+    uint32_t rdata[64];
+    return ch32_read_memory_block(handle, addr, rdata, 64) && memcmp(page, rdata, sizeof(rdata)) == 0;
+}
+
+// Decide what programming a page of the image takes:
+// - with `differential`, pages the target already holds are skipped,
+// - with `elide_blank`, pages that are entirely 0xFF are only erased, or skipped with `skip_blank`
+//   when the target page already reads blank.
+static ch32_page_action_t ch32_plan_page(rvswd_handle_t *handle, uint32_t addr, uint32_t const page[64],
+                                         ch32_program_options_t const *options, bool use_crc) {
+    bool blank   = options->elide_blank && ch32_page_is_blank(page);
+    bool compare = options->differential || (blank && options->skip_blank);
+    if (compare && ch32_page_matches(handle, addr, page, use_crc)) {
+        return CH32_PAGE_SKIP;
+    }
+    return blank ? CH32_PAGE_ERASE : CH32_PAGE_WRITE;
+}
+
+// Plan every page of an image in memory with ch32_plan_page.
+void ch32_plan_pages(rvswd_handle_t *handle, uint32_t addr, void const *_data, size_t data_len,
+                     ch32_program_options_t const *options, bool use_crc, uint8_t *plan, ch32_plan_stats_t *stats) {
     uint8_t const *data = _data;
+    uint32_t       page[64];
 
-    char buffer[32];
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < data_len; i += 256) {
+        vTaskDelay(0);
+        ch32_stage_page((uint8_t *)page, data, data_len, i);
+
+        plan[i / 256] = ch32_plan_page(handle, addr + i, page, options, use_crc);
+        if (plan[i / 256] == CH32_PAGE_SKIP) {
+            stats->skipped++;
+        } else if (plan[i / 256] == CH32_PAGE_ERASE) {
+            stats->erased++;
+        }
+    }
+}
+
+// A NULL plan erases every page.
+static bool ch32_page_needs_erase(uint8_t const *plan, size_t index) {
+    return plan == NULL || plan[index] == CH32_PAGE_WRITE || plan[index] == CH32_PAGE_ERASE;
+}
+
+// Walk the sectors covered by the plan, erasing each with either one sector erase, when all of its
+// pages need erasing and that is quicker, or fast page erases of the pages that need it. Returns the
+// estimated flash-busy time, or -1 when an erase failed. Only estimates without `execute`.
+static int64_t ch32_erase_sectors(rvswd_handle_t *handle, uint32_t addr, uint8_t *plan, size_t pages, bool execute) {
+    size_t  per_sector = handle->target.sector_size / CH32_FLASH_PAGE_SIZE;
+    int64_t page_us    = ch32_erase_time(handle->erase_times.page_us, CH32_ERASE_PAGE_US);
+    int64_t sector_us  = ch32_erase_time(handle->erase_times.sector_us, CH32_ERASE_SECTOR_US);
+    int64_t cost       = 0;
+
+    for (size_t first = 0; first < pages; first += per_sector) {
+        size_t count  = (pages - first < per_sector) ? pages - first : per_sector;
+        size_t needed = 0;
+        for (size_t i = first; i < first + count; i++) {
+            needed += ch32_page_needs_erase(plan, i);
+        }
+        if (needed == 0) {
+            continue;
+        }
+
+        uint32_t sector = addr + first * CH32_FLASH_PAGE_SIZE;
+        if (needed == per_sector && sector % handle->target.sector_size == 0 &&
+            sector_us < (int64_t)per_sector * page_us) {
+            cost += sector_us;
+            if (execute && !ch32_erase_flash_sector(handle, sector)) {
+                return -1;
+            }
+        } else {
+            cost += (int64_t)needed * page_us;
+            for (size_t i = first; execute && i < first + count; i++) {
+                if (ch32_page_needs_erase(plan, i) && !ch32_erase_flash_block(handle, addr + i * CH32_FLASH_PAGE_SIZE)) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return cost;
+}
+
+// If unlocked: Erase all pages of the plan that need it before programming starts, choosing between
+// a mass erase, sector erases and fast page erases by the least flash-busy time. A mass erase is
+// only considered when the plan replaces all flash of the part. Requires ch32_probe. Erased pages
+// are marked CH32_PAGE_PROGRAM, or CH32_PAGE_SKIP when they only needed erasing. A NULL plan erases
+// all `pages`.
+bool ch32_erase_planned(rvswd_handle_t *handle, uint32_t addr, uint8_t *plan, size_t pages) {
+    if (handle->target.flash_size == 0 || !ch32_flash_range_valid(handle, addr, pages * CH32_FLASH_PAGE_SIZE)) {
+        return false;
+    }
+
+    size_t needed = 0;
+    for (size_t i = 0; i < pages; i++) {
+        needed += ch32_page_needs_erase(plan, i);
+    }
+    if (needed == 0) {
+        return true;
+    }
+
+    bool    whole = addr == handle->target.flash_base && pages * CH32_FLASH_PAGE_SIZE == handle->target.flash_size &&
+                 needed == pages;
+    int64_t cost  = ch32_erase_sectors(handle, addr, plan, pages, false);
+    if (whole && ch32_erase_time(handle->erase_times.mass_us, CH32_ERASE_MASS_US) < cost) {
+        if (!ch32_erase_flash_mass(handle)) {
+            return false;
+        }
+    } else if (ch32_erase_sectors(handle, addr, plan, pages, true) < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; plan && i < pages; i++) {
+        if (plan[i] == CH32_PAGE_WRITE) {
+            plan[i] = CH32_PAGE_PROGRAM;
+        } else if (plan[i] == CH32_PAGE_ERASE) {
+            plan[i] = CH32_PAGE_SKIP;
+        }
+    }
+    return true;
+}
+
+// What to do with a staged page: taken from the plan when there is one, otherwise decided now for
+// streamed images.
+static uint8_t ch32_image_action(rvswd_handle_t *handle, uint32_t addr, ch32_image_t const *image,
+                                 uint8_t const *plan, size_t offset, uint32_t const page[64]) {
+    if (plan) {
+        return plan[offset / 256];
+    }
+    if (image->erased) {
+        return ch32_page_is_blank(page) ? CH32_PAGE_SKIP : CH32_PAGE_PROGRAM;
+    }
+    if (image->options) {
+        return ch32_plan_page(handle, addr, page, image->options, image->use_crc);
+    }
+    return CH32_PAGE_WRITE;
+}
+
+// Check whether the target flash already holds the image, padded to whole pages as it would be
+// programmed. Compares a single CRC over the whole image when the CRC unit is usable, otherwise
+// reads the image back.
+bool ch32_flash_matches(rvswd_handle_t *handle, uint32_t addr, void const *_data, size_t data_len, bool use_crc) {
+    uint8_t const *data = _data;
+    uint32_t       page[64];
+    uint32_t       rdata[64];
+    uint32_t       crc = 0xFFFFFFFF;
 
     for (size_t i = 0; i < data_len; i += 256) {
+        ch32_stage_page((uint8_t *)page, data, data_len, i);
+        if (use_crc) {
+            crc = ch32_crc32(crc, page, 64);
+        } else if (!ch32_read_memory_block(handle, addr + i, rdata, 64) || memcmp(page, rdata, sizeof(page)) != 0) {
+            return false;
+        }
+    }
+
+    if (use_crc) {
+        uint32_t target_crc;
+        size_t   words = (data_len + 255) / 256 * 64;
+        return ch32_crc_memory(handle, addr, words, &target_crc) && target_crc == crc;
+    }
+    return true;
+}
+
+// Loader writer for ch32_loader_write_flash, taking pages from `image`.
+static bool ch32_loader_write_image(rvswd_handle_t *handle, uint32_t addr, ch32_image_t *image, uint8_t const *plan) {
+    if (addr % 256 || !ch32_flash_range_valid(handle, addr, image->len)) {
+        return false;
+    }
+
+    char     buffer[32];
+    uint32_t scratch[64];
+    uint32_t block[64];
+    uint32_t previous[2] = {0, 0}; // Page address and buffer of the page being programmed.
+    uint32_t result;
+    int64_t  upload_us = 0;
+    int64_t  target_us = 0;
+    size_t   pages     = 0;
+    size_t   sent      = 0; // Bytes uploaded.
+
+    bool stopped = false;
+    for (size_t i = 0; i < image->len; i += 256) {
+        if (plan && plan[i / 256] == CH32_PAGE_SKIP) {
+            continue;
+        }
+        // Stop with the page in flight finished and verified.
+        if (ch32_job_stop(image)) {
+            stopped = true;
+            break;
+        }
+
+        uint32_t const *page = ch32_image_page(image, i, scratch);
+        if (page == NULL) {
+            return false;
+        }
+        uint8_t action = ch32_image_action(handle, addr + i, image, plan, i, page);
+        if (action == CH32_PAGE_SKIP) {
+            continue;
+        }
+
         vTaskDelay(0);
         snprintf(buffer, sizeof(buffer) - 1, "Writing at 0x%08" PRIx32, addr + i);
-        ch32_status_callback(buffer, i, data_len);
+        ch32_report(image, buffer, i, image->len);
+
+        // Only the upload counts as wire time, not comparing the page with flash to decide its action.
+        int64_t start = esp_timer_get_time();
+
+        // Blank pages are only erased, there is nothing to upload or verify.
+        bool     erase_only = action == CH32_PAGE_ERASE;
+        uint32_t sram       = 0;
+
+        // Compressed blocks smaller than the page are expanded by the loader.
+        uint32_t packed     = 0;
+        size_t   packed_len = image->packed ? image->packed->block_len : 256;
+        if (!erase_only) {
+            sram = CH32_LOADER_BUFFER + (pages % CH32_LOADER_BUFFER_COUNT) * 256;
+            bool res;
+            if (packed_len < 256) {
+                memcpy(block, image->packed->block, packed_len);
+                packed = CH32_LOADER_PACKED;
+                res    = ch32_write_memory_block(handle, packed, block, (packed_len + 3) / 4);
+                sent  += (packed_len + 3) / 4 * 4;
+            } else {
+                res   = ch32_write_memory_block(handle, sram, page, 64);
+                sent += 256;
+            }
+            if (!res) {
+                ESP_LOGE(TAG, "Error: Failed to upload page for %08" PRIx32, addr + i);
+                return false;
+            }
+        }
+        int64_t uploaded = esp_timer_get_time();
+        upload_us += uploaded - start;
 
-        if (!ch32_erase_flash_block(handle, addr + i)) {
+        uint32_t page_arg = addr + i;
+        if (action == CH32_PAGE_PROGRAM) {
+            page_arg |= 1; // Already erased.
+        }
+        uint32_t args[CH32_LOADER_ARGS] = {page_arg, sram, previous[0], previous[1], packed, packed ? packed_len : 0};
+        if (!ch32_loader_call(handle, args, &result)) {
+            ESP_LOGE(TAG, "Error: Failed to write FLASH at %08" PRIx32, addr + i);
+            return false;
+        }
+        target_us += esp_timer_get_time() - uploaded;
+        if (result != 0) {
+            ESP_LOGE(TAG, "Write block mismatch at %08" PRIx32, result);
+            return false;
+        }
+
+        previous[0] = erase_only ? 0 : addr + i;
+        previous[1] = sram;
+        pages++;
+    }
+
+    if (pages > 0) {
+        // Wait for the last page and verify it.
+        uint32_t args[CH32_LOADER_ARGS] = {0, 0, previous[0], previous[1], 0, 0};
+        int64_t  start   = esp_timer_get_time();
+        if (!ch32_loader_call(handle, args, &result)) {
+            ESP_LOGE(TAG, "Error: Failed to finish FLASH at %08" PRIx32, previous[0]);
+            return false;
+        }
+        target_us += esp_timer_get_time() - start;
+        if (result != 0) {
+            ESP_LOGE(TAG, "Write block mismatch at %08" PRIx32, result);
+            return false;
+        }
+
+        ESP_LOGI(TAG, "Loader: %zu pages, upload %" PRId64 " us, target %" PRId64 " us (%s-bound)", pages, upload_us,
+                 target_us, upload_us >= target_us ? "wire" : "flash");
+        // Raw is what the wire moves, effective is the page data that delivers in the same time.
+        if (upload_us > 0) {
+            ESP_LOGI(TAG, "Loader: %zu bytes sent for %zu, raw %" PRId64 " B/s, effective %" PRId64 " B/s", sent,
+                     pages * 256, (int64_t)sent * 1000000 / upload_us, (int64_t)pages * 256 * 1000000 / upload_us);
+        }
+    }
+
+    return !stopped;
+}
+
+// Debug module writer for ch32_write_flash, taking pages from `image`.
+static bool ch32_write_image(rvswd_handle_t *handle, uint32_t addr, ch32_image_t *image, ch32_verify_t verify,
+                             uint8_t const *plan) {
+    if (addr % 64 || !ch32_flash_range_valid(handle, addr, image->len)) {
+        return false;
+    }
+
+    char     buffer[32];
+    uint32_t scratch[64];
+
+    for (size_t i = 0; i < image->len; i += 256) {
+        if (plan && plan[i / 256] == CH32_PAGE_SKIP) {
+            continue;
+        }
+        if (ch32_job_stop(image)) {
+            return false;
+        }
+
+        uint32_t const *page = ch32_image_page(image, i, scratch);
+        if (page == NULL) {
+            return false;
+        }
+        uint8_t action = ch32_image_action(handle, addr + i, image, plan, i, page);
+        if (action == CH32_PAGE_SKIP) {
+            continue;
+        }
+
+        vTaskDelay(0);
+        snprintf(buffer, sizeof(buffer) - 1, "Writing at 0x%08" PRIx32, addr + i);
+        ch32_report(image, buffer, i, image->len);
+
+        if (action != CH32_PAGE_PROGRAM && !ch32_erase_flash_block(handle, addr + i)) {
             ESP_LOGE(TAG, "Error: Failed to erase FLASH at %08" PRIx32, addr + i);
             return false;
         }
 
-        if (!ch32_write_flash_block(handle, addr + i, data + i)) {
+        if (action == CH32_PAGE_ERASE) {
+            continue;
+        }
+
+        if (!ch32_write_flash_block(handle, addr + i, page, verify)) {
             ESP_LOGE(TAG, "Error: Failed to write FLASH at %08" PRIx32, addr + i);
             return false;
         }
@@ -365,28 +1612,107 @@ bool ch32_write_flash(rvswd_handle_t *handle, uint32_t addr, void const *_data,
     return true;
 }
 
+// If unlocked: Erase, write and verify a range of FLASH memory using the loader, which must have
+// been set up with ch32_loader_init. Uploading a page overlaps with programming the previous one.
+// Time spent uploading and waiting for the target is logged, showing which of the two limits the
+// throughput.
+// Pages marked CH32_PAGE_SKIP in `plan` are left alone, a NULL plan writes every page.
+bool ch32_loader_write_flash(rvswd_handle_t *handle, uint32_t addr, void const *data, size_t data_len,
+                             uint8_t const *plan) {
+    ch32_image_t image = {.data = data, .len = data_len};
+    return ch32_loader_write_image(handle, addr, &image, plan);
+}
+
+// If unlocked: Erase and write a range of FLASH memory.
+// Pages marked CH32_PAGE_SKIP in `plan` are left alone, a NULL plan writes every page.
+bool ch32_write_flash(rvswd_handle_t *handle, uint32_t addr, void const *data, size_t data_len, ch32_verify_t verify,
+                      uint8_t const *plan) {
+    ch32_image_t image = {.data = data, .len = data_len};
+    return ch32_write_image(handle, addr, &image, verify, plan);
+}
+
 // Program and restart the CH32V203.
 void ch32_program(rvswd_handle_t *handle, void const *firmware, size_t firmware_len) {
+    ch32_program_options_t options = {0};
+    ch32_program_with_options(handle, firmware, firmware_len, &options);
+}
+
+// Leave the target halted with flash locked once a job stopped.
+static bool ch32_job_stopped(rvswd_handle_t *handle) {
+    ch32_write_memory_word(handle, CH32_FLASH_CTLR, CH32_FLASH_CTLR_LOCK);
+    ESP_LOGW(TAG, "Cancelled, target left halted");
+    return false;
+}
+
+static bool ch32_program_image(rvswd_handle_t *handle, ch32_image_t *image, ch32_program_options_t const *options) {
     rvswd_result_t res;
 
+    if (image->len == 0) {
+        ESP_LOGE(TAG, "Empty firmware image");
+        return false;
+    }
+
     res = rvswd_init(handle);
 
     if (res != RVSWD_OK) {
         ESP_LOGE(TAG, "Init error %u!", res);
-        return;
+        return false;
     }
 
     res = rvswd_reset(handle);
 
     if (res != RVSWD_OK) {
         ESP_LOGE(TAG, "Reset error %u!", res);
-        return;
+        return false;
+    }
+
+    uint32_t bitrate;
+    if (rvswd_measure_bitrate(handle, CH32_REG_DEBUG_DMSTATUS, 32, &bitrate) == RVSWD_OK) {
+        ESP_LOGI(TAG, "RVSWD wire rate: %" PRIu32 " bit/s (%s)", bitrate, handle->transport->name);
     }
 
     res = ch32_halt_microprocessor(handle);
     if (res != RVSWD_OK) {
         ESP_LOGE(TAG, "Failed to halt");
-        return;
+        return false;
+    }
+
+    if (!ch32_probe(handle)) {
+        ESP_LOGE(TAG, "Failed to identify the target");
+        return false;
+    }
+    if (image->len > handle->target.flash_size) {
+        ESP_LOGE(TAG, "Image of %zu bytes does not fit in %" PRIu32 " bytes of flash", image->len,
+                 handle->target.flash_size);
+        return false;
+    }
+    if (image->len > handle->target.zero_wait_size) {
+        ESP_LOGW(TAG, "Image extends past the %" PRIu32 " KiB zero-wait region", handle->target.zero_wait_size / 1024);
+    }
+    uint32_t base = handle->target.flash_base;
+
+    bool use_crc = false;
+    if (options->skip_if_identical || options->differential || options->skip_blank || options->target_decompress ||
+        (!options->use_loader && options->verify == CH32_VERIFY_CRC)) {
+        use_crc = ch32_crc_init(handle);
+        if (!use_crc) {
+            ESP_LOGW(TAG, "CRC unit not usable, comparing by reading back");
+        }
+    }
+
+    uint32_t target_crc;
+    if (options->skip_if_identical &&
+        (image->data ? ch32_flash_matches(handle, base, image->data, image->len, use_crc)
+                     : image->has_crc && use_crc &&
+                           ch32_crc_memory(handle, base, (image->len + 255) / 256 * 64, &target_crc) &&
+                           target_crc == image->crc)) {
+        ch32_report(image, "Firmware already up to date", image->len, image->len);
+        res = options->fast_restart ? ch32_restart_microprocessor(handle) : ch32_reset_microprocessor_and_run(handle);
+        return res == RVSWD_OK;
+    }
+
+    if (ch32_job_stop(image)) {
+        return ch32_job_stopped(handle);
     }
 
     bool bool_res = ch32_unlock_flash(handle);
@@ -395,24 +1721,313 @@ void ch32_program(rvswd_handle_t *handle, void const *firmware, size_t firmware_
 
     if (!bool_res) {
         ESP_LOGE(TAG, "Failed to unlock");
-        return;
+        return false;
+    }
+
+    if (options->use_loader && !ch32_loader_init(handle)) {
+        ESP_LOGE(TAG, "Failed to start flash loader");
+        return false;
     }
 
-    bool_res = ch32_write_flash(handle, 0x08000000, firmware, firmware_len);
+    ch32_verify_t verify = use_crc ? options->verify : CH32_VERIFY_READBACK;
+
+    // The loader verifies pages against what it expanded, the image CRC checks the expansion.
+    ch32_decompressor_t *packed = image->packed;
+    image->packed               = NULL;
+    if (options->use_loader && packed && use_crc) {
+        image->packed = packed;
+    } else if (options->target_decompress && packed) {
+        ESP_LOGW(TAG, "Expanding on the target needs the loader and the CRC unit, sending pages uncompressed");
+    }
+
+    uint8_t *plan = NULL;
+    if (image->data == NULL) {
+        // Streamed pages are planned as they arrive, there is no second pass to compare against
+        // once everything was erased up front.
+        image->options = options;
+        image->use_crc = use_crc;
+        if (options->skip_if_identical && !(image->has_crc && use_crc)) {
+            ESP_LOGW(TAG, "Streamed image, checking whether it is up to date is not possible");
+        }
+        if (options->plan_erase) {
+            ch32_report(image, "Erasing", 0, (image->len + 255) / 256);
+            if (!ch32_erase_planned(handle, base, NULL, (image->len + 255) / 256)) {
+                ESP_LOGE(TAG, "Failed to erase flash");
+                return false;
+            }
+            image->erased = true;
+        }
+    } else if (options->differential || options->elide_blank || options->plan_erase) {
+        size_t pages = (image->len + 255) / 256;
+        plan         = calloc(pages, 1);
+        if (plan == NULL) {
+            ESP_LOGE(TAG, "Out of memory");
+            return false;
+        }
+
+        ch32_plan_stats_t stats;
+        ch32_plan_pages(handle, base, image->data, image->len, options, use_crc, plan, &stats);
+
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer) - 1, "Skipping %zu unchanged pages, erasing %zu blank pages", stats.skipped,
+                 stats.erased);
+        ch32_report(image, buffer, stats.skipped, pages);
+
+        if (options->plan_erase) {
+            ch32_report(image, "Erasing", 0, pages);
+        }
+        if (options->plan_erase && !ch32_erase_planned(handle, base, plan, pages)) {
+            ESP_LOGE(TAG, "Failed to erase flash");
+            free(plan);
+            return false;
+        }
+    }
+
+    if (ch32_job_stop(image)) {
+        free(plan);
+        return ch32_job_stopped(handle);
+    }
+
+    if (options->use_loader) {
+        bool_res = ch32_loader_write_image(handle, base, image, plan);
+    } else {
+        bool_res = ch32_write_image(handle, base, image, verify, plan);
+    }
+    free(plan);
+    if (!bool_res && image->job && image->job->stopped) {
+        return ch32_job_stopped(handle);
+    }
     if (!bool_res) {
         ESP_LOGE(TAG, "Failed to write flash");
-        return;
+        return false;
     };
-    res = ch32_reset_microprocessor_and_run(handle);
+
+    uint32_t image_crc;
+    if (image->packed && !(ch32_crc_memory(handle, base, (image->len + 255) / 256 * 64, &image_crc) &&
+                           image_crc == image->crc)) {
+        ESP_LOGE(TAG, "Flash does not match the image CRC after expanding on the target");
+        return false;
+    }
+    res = options->fast_restart ? ch32_restart_microprocessor(handle) : ch32_reset_microprocessor_and_run(handle);
     if (res != RVSWD_OK) {
         ESP_LOGE(TAG, "Failed to reset and run");
-        return;
+        return false;
     }
 
+    ESP_LOGI(TAG, "PROGBUF writes saved: %" PRIu32 ", register writes saved: %" PRIu32, handle->progbuf.writes_saved,
+             handle->gpr.writes_saved);
     ESP_LOGI(TAG, "Okay!");
+    return true;
+}
+
+static bool ch32_program_packed(rvswd_handle_t *handle, void const *compressed, size_t compressed_len,
+                                ch32_program_options_t const *options, ch32_job_t *job) {
+    ch32_decompressor_t decompressor;
+    if (!ch32_decompressor_init(&decompressor, compressed, compressed_len)) {
+        ch32_decompressor_free(&decompressor);
+        return false;
+    }
+    ch32_image_t image = {
+        .reader     = ch32_decompressor_read,
+        .reader_ctx = &decompressor,
+        .len        = decompressor.header.length,
+        .has_crc    = true,
+        .crc        = decompressor.header.crc,
+        .packed     = options->target_decompress ? &decompressor : NULL,
+        .job        = job,
+    };
+    bool res = ch32_program_image(handle, &image, options);
+    ch32_decompressor_free(&decompressor);
+    return res;
+}
+
+static bool ch32_program_data(rvswd_handle_t *handle, void const *firmware, size_t firmware_len,
+                              ch32_program_options_t const *options, ch32_job_t *job) {
+    if (ch32_compressed_detect(firmware, firmware_len)) {
+        return ch32_program_packed(handle, firmware, firmware_len, options, job);
+    }
+    ch32_image_t image = {.data = firmware, .len = firmware_len, .job = job};
+    return ch32_program_image(handle, &image, options);
+}
+
+// Program and restart the CH32V203 with non-default options, returns false on failure.
+bool ch32_program_with_options(rvswd_handle_t *handle, void const *firmware, size_t firmware_len,
+                               ch32_program_options_t const *options) {
+    return ch32_program_data(handle, firmware, firmware_len, options, NULL);
+}
+
+// Program and restart the CH32V203 from an image of `firmware_len` bytes pulled from `reader`.
+bool ch32_program_stream(rvswd_handle_t *handle, ch32_reader_t reader, void *reader_ctx, size_t firmware_len,
+                         ch32_program_options_t const *options) {
+    ch32_image_t image = {.reader = reader, .reader_ctx = reader_ctx, .len = firmware_len};
+    return ch32_program_image(handle, &image, options);
+}
+
+// Program and restart the CH32V203 from a compressed image, decompressed a page at a time.
+bool ch32_program_compressed(rvswd_handle_t *handle, void const *compressed, size_t compressed_len,
+                             ch32_program_options_t const *options) {
+    return ch32_program_packed(handle, compressed, compressed_len, options, NULL);
+}
+
+// Program and restart the CH32V203 with `len` bytes at `offset` of `partition`, mapped into memory
+// and used in place.
+bool ch32_program_partition(rvswd_handle_t *handle, esp_partition_t const *partition, size_t offset, size_t len,
+                            ch32_program_options_t const *options) {
+    void const                 *data;
+    esp_partition_mmap_handle_t mapping;
+    esp_err_t err = esp_partition_mmap(partition, offset, len, ESP_PARTITION_MMAP_DATA, &data, &mapping);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition %s: %s", partition->label, esp_err_to_name(err));
+        return false;
+    }
+    bool res = ch32_program_with_options(handle, data, len, options);
+    esp_partition_munmap(mapping);
+    return res;
+}
+
+// Take every page of `image` the way the writers do and CRC it, returning the CRC.
+static uint32_t ch32_benchmark_pages(ch32_image_t *image) {
+    uint32_t scratch[64];
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < image->len; i += 256) {
+        crc = ch32_crc32(crc, ch32_image_page(image, i, scratch), 64);
+    }
+    return crc;
+}
+
+bool ch32_benchmark_partition(esp_partition_t const *partition, size_t offset, size_t len,
+                              ch32_partition_benchmark_t *result) {
+    int64_t  start = esp_timer_get_time();
+    uint8_t *copy  = malloc(len);
+    if (copy == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        return false;
+    }
+    if (esp_partition_read(partition, offset, copy, len) != ESP_OK) {
+        free(copy);
+        return false;
+    }
+    ch32_image_t image    = {.data = copy, .len = len};
+    uint32_t     copy_crc = ch32_benchmark_pages(&image);
+    free(copy);
+    result->copy_us   = esp_timer_get_time() - start;
+    result->copy_heap = len;
+
+    start = esp_timer_get_time();
+    void const                 *data;
+    esp_partition_mmap_handle_t mapping;
+    if (esp_partition_mmap(partition, offset, len, ESP_PARTITION_MMAP_DATA, &data, &mapping) != ESP_OK) {
+        return false;
+    }
+    image             = (ch32_image_t){.data = data, .len = len};
+    uint32_t mmap_crc = ch32_benchmark_pages(&image);
+    esp_partition_munmap(mapping);
+    result->mmap_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "%zu bytes from %s: heap copy %" PRId64 " us using %zu bytes, mmap %" PRId64 " us", len,
+             partition->label, result->copy_us, result->copy_heap, result->mmap_us);
+    return copy_crc == mmap_crc;
+}
+
+bool ch32_restart(rvswd_handle_t *handle) {
+    rvswd_result_t res = rvswd_init(handle);
+    if (res != RVSWD_OK) {
+        ESP_LOGE(TAG, "Init error %u!", res);
+        return false;
+    }
+    res = rvswd_reset(handle);
+    if (res != RVSWD_OK) {
+        ESP_LOGE(TAG, "Reset error %u!", res);
+        return false;
+    }
+    // The target was just attached, so activate the debug module before the reset request.
+    rvswd_write(handle, CH32_REG_DEBUG_DMCONTROL, 0x00000001);
+    return ch32_restart_microprocessor(handle) == RVSWD_OK;
+}
+
+static void ch32_job_task(void *arg) {
+    ch32_job_t *job = arg;
+    bool res = ch32_program_data(job->handle, job->firmware, job->firmware_len, &job->config.options, job);
+
+    ch32_job_event_t event = {.job = job};
+    if (res) {
+        event.state = CH32_JOB_DONE;
+        strlcpy(event.message, "Done", sizeof(event.message));
+    } else if (job->stopped) {
+        event.state = CH32_JOB_CANCELLED;
+        strlcpy(event.message, "Cancelled", sizeof(event.message));
+    } else {
+        event.state = CH32_JOB_FAILED;
+        strlcpy(event.message, "Failed", sizeof(event.message));
+    }
+    job->state = event.state;
+    ch32_job_emit(job, &event);
+
+    xSemaphoreGive(job->finished);
+    vTaskDelete(NULL);
+}
+
+ch32_job_t *ch32_job_start(rvswd_handle_t *handle, void const *firmware, size_t firmware_len,
+                           ch32_job_config_t const *config) {
+    ch32_job_t *job = calloc(1, sizeof(ch32_job_t));
+    if (job == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        return NULL;
+    }
+    job->handle       = handle;
+    job->firmware     = firmware;
+    job->firmware_len = firmware_len;
+    job->config       = *config;
+    job->state        = CH32_JOB_RUNNING;
+    job->finished     = xSemaphoreCreateBinary();
+    if (job->finished == NULL) {
+        free(job);
+        return NULL;
+    }
+
+    uint32_t    stack_size = config->stack_size ? config->stack_size : CH32_JOB_STACK_SIZE;
+    UBaseType_t priority   = config->priority ? config->priority : CH32_JOB_PRIORITY;
+    if (xTaskCreate(ch32_job_task, "ch32_job", stack_size, job, priority, &job->task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start job task");
+        vSemaphoreDelete(job->finished);
+        free(job);
+        return NULL;
+    }
+    return job;
+}
+
+ch32_job_state_t ch32_job_state(ch32_job_t const *job) {
+    return job->state;
+}
+
+void ch32_job_cancel(ch32_job_t *job) {
+    job->cancel = true;
+}
+
+ch32_job_state_t ch32_job_wait(ch32_job_t *job, TickType_t timeout) {
+    if (xSemaphoreTake(job->finished, timeout) != pdTRUE) {
+        return CH32_JOB_RUNNING;
+    }
+    // Leave it given for later waits.
+    xSemaphoreGive(job->finished);
+    return job->state;
+}
+
+void ch32_job_free(ch32_job_t *job) {
+    if (job == NULL) {
+        return;
+    }
+    ch32_job_cancel(job);
+    ch32_job_wait(job, portMAX_DELAY);
+    vSemaphoreDelete(job->finished);
+    free(job);
 }
 
 // Default status callback implementation.
 void __attribute__((weak)) ch32_status_callback(char const *msg, int progress, int total) {
+    if (total == 0) {
+        ESP_LOGI(TAG, "%s", msg);
+        return;
+    }
     ESP_LOGI(TAG, "%s: %d%% (%d/%d)", msg, progress * 100 / total, progress, total);
 }
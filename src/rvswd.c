@@ -6,12 +6,90 @@
 
 #include "rvswd.h"
 
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "rvswd_internal.h"
 #include "rom/ets_sys.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc_caps.h"
 
 #include <inttypes.h>
 #include <stdint.h>
+#include <string.h>
+
+// Number of clocked bits in a single read or write frame.
+#define RVSWD_FRAME_BITS 52
+
+static rvswd_gpio_regs_t rvswd_gpio_regs(gpio_num_t pin) {
+    rvswd_gpio_regs_t regs;
+#if SOC_GPIO_PIN_COUNT > 32
+    if (pin >= 32) {
+        regs.w1ts = (volatile uint32_t *)GPIO_OUT1_W1TS_REG;
+        regs.w1tc = (volatile uint32_t *)GPIO_OUT1_W1TC_REG;
+        regs.in   = (volatile uint32_t *)GPIO_IN1_REG;
+        regs.mask = 1UL << (pin - 32);
+        return regs;
+    }
+#endif
+    regs.w1ts = (volatile uint32_t *)GPIO_OUT_W1TS_REG;
+    regs.w1tc = (volatile uint32_t *)GPIO_OUT_W1TC_REG;
+    regs.in   = (volatile uint32_t *)GPIO_IN_REG;
+    regs.mask = 1UL << pin;
+    return regs;
+}
 
-rvswd_result_t rvswd_init(rvswd_handle_t *handle) {
+rvswd_timing_t const rvswd_timing_default = {
+    .half_period_ns = 0,
+    .start_hold_ns  = 1000,
+    .stop_hold_ns   = 1000,
+};
+
+static inline rvswd_timing_t const *rvswd_timing(rvswd_handle_t *handle) {
+    return handle->timing ? handle->timing : &rvswd_timing_default;
+}
+
+// Busy-wait on the CPU cycle counter, which unlike ets_delay_us resolves well below a microsecond.
+static inline void rvswd_delay_ns(uint32_t ns) {
+    if (ns == 0) {
+        return;
+    }
+    uint32_t cycles = ns * esp_rom_get_cpu_ticks_per_us() / 1000;
+    uint32_t start  = esp_cpu_get_cycle_count();
+    while (esp_cpu_get_cycle_count() - start < cycles) {
+    }
+}
+
+static inline bool rvswd_uses_driver(rvswd_handle_t *handle) {
+    return handle->transport == &rvswd_transport_gpio;
+}
+
+// Everything except rvswd_transport_gpio uses the direct registers for the edges it drives itself.
+static inline void rvswd_set_swdio(rvswd_handle_t *handle, bool level) {
+    if (rvswd_uses_driver(handle)) {
+        gpio_set_level(handle->swdio, level);
+    } else {
+        *(level ? handle->swdio_regs.w1ts : handle->swdio_regs.w1tc) = handle->swdio_regs.mask;
+    }
+}
+
+static inline void rvswd_set_swclk(rvswd_handle_t *handle, bool level) {
+    if (rvswd_uses_driver(handle)) {
+        gpio_set_level(handle->swclk, level);
+    } else {
+        *(level ? handle->swclk_regs.w1ts : handle->swclk_regs.w1tc) = handle->swclk_regs.mask;
+    }
+}
+
+static inline bool rvswd_get_swdio(rvswd_handle_t *handle) {
+    if (rvswd_uses_driver(handle)) {
+        return gpio_get_level(handle->swdio);
+    } else {
+        return (*handle->swdio_regs.in & handle->swdio_regs.mask) != 0;
+    }
+}
+
+rvswd_result_t rvswd_gpio_init(rvswd_handle_t *handle) {
     gpio_config_t swio_cfg = {
         .pin_bit_mask = BIT64(handle->swdio),
         .mode         = GPIO_MODE_INPUT_OUTPUT_OD,
@@ -36,65 +114,78 @@ rvswd_result_t rvswd_init(rvswd_handle_t *handle) {
         return RVSWD_FAIL;
     }
 
+    handle->swdio_regs = rvswd_gpio_regs(handle->swdio);
+    handle->swclk_regs = rvswd_gpio_regs(handle->swclk);
+
     return RVSWD_OK;
 }
 
 rvswd_result_t rvswd_start(rvswd_handle_t *handle) {
+    uint32_t hold = rvswd_timing(handle)->start_hold_ns;
+
     // Start with both lines high
-    gpio_set_level(handle->swdio, true);
-    gpio_set_level(handle->swclk, true);
-    ets_delay_us(2);
+    rvswd_set_swdio(handle, true);
+    rvswd_set_swclk(handle, true);
+    rvswd_delay_ns(2 * hold);
 
     // Pull data low
-    gpio_set_level(handle->swdio, false);
-    gpio_set_level(handle->swclk, true);
-    ets_delay_us(1);
+    rvswd_set_swdio(handle, false);
+    rvswd_set_swclk(handle, true);
+    rvswd_delay_ns(hold);
 
     // Pull clock low
-    gpio_set_level(handle->swdio, false);
-    gpio_set_level(handle->swclk, false);
-    ets_delay_us(1);
+    rvswd_set_swdio(handle, false);
+    rvswd_set_swclk(handle, false);
+    rvswd_delay_ns(hold);
     return RVSWD_OK;
 }
 
 rvswd_result_t rvswd_stop(rvswd_handle_t *handle) {
+    uint32_t hold = rvswd_timing(handle)->stop_hold_ns;
+
     // Pull data low
-    gpio_set_level(handle->swdio, false);
-    ets_delay_us(1);
-    gpio_set_level(handle->swclk, true);
-    ets_delay_us(2);
+    rvswd_set_swdio(handle, false);
+    rvswd_delay_ns(hold);
+    rvswd_set_swclk(handle, true);
+    rvswd_delay_ns(2 * hold);
     // Let data float high
-    gpio_set_level(handle->swdio, true);
-    ets_delay_us(1);
+    rvswd_set_swdio(handle, true);
+    rvswd_delay_ns(hold);
     return RVSWD_OK;
 }
 
-rvswd_result_t rvswd_reset(rvswd_handle_t *handle) {
-    gpio_set_level(handle->swdio, true);
+rvswd_result_t rvswd_gpio_reset(rvswd_handle_t *handle) {
+    rvswd_set_swdio(handle, true);
     ets_delay_us(1);
     for (uint8_t i = 0; i < 100; i++) {
-        gpio_set_level(handle->swclk, false);
+        rvswd_set_swclk(handle, false);
         ets_delay_us(1);
-        gpio_set_level(handle->swclk, true);
+        rvswd_set_swclk(handle, true);
         ets_delay_us(1);
     }
     return rvswd_stop(handle);
 }
 
 void rvswd_write_bit(rvswd_handle_t *handle, bool value) {
-    gpio_set_level(handle->swdio, value);
-    gpio_set_level(handle->swclk, false);
-    gpio_set_level(handle->swclk, true); // Data is sampled on rising edge of clock
+    uint32_t half = rvswd_timing(handle)->half_period_ns;
+    rvswd_set_swdio(handle, value);
+    rvswd_set_swclk(handle, false);
+    rvswd_delay_ns(half);
+    rvswd_set_swclk(handle, true); // Data is sampled on rising edge of clock
+    rvswd_delay_ns(half);
 }
 
 bool rvswd_read_bit(rvswd_handle_t *handle) {
-    gpio_set_level(handle->swdio, true);
-    gpio_set_level(handle->swclk, false);
-    gpio_set_level(handle->swclk, true); // Data is output on rising edge of clock
-    return gpio_get_level(handle->swdio);
+    uint32_t half = rvswd_timing(handle)->half_period_ns;
+    rvswd_set_swdio(handle, true);
+    rvswd_set_swclk(handle, false);
+    rvswd_delay_ns(half);
+    rvswd_set_swclk(handle, true); // Data is output on rising edge of clock
+    rvswd_delay_ns(half);
+    return rvswd_get_swdio(handle);
 }
 
-rvswd_result_t rvswd_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+static rvswd_result_t rvswd_gpio_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
     rvswd_start(handle);
 
     // ADDR HOST
@@ -142,7 +233,7 @@ rvswd_result_t rvswd_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value)
     return RVSWD_OK;
 }
 
-rvswd_result_t rvswd_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+static rvswd_result_t rvswd_gpio_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
     bool parity;
 
     rvswd_start(handle);
@@ -194,3 +285,161 @@ rvswd_result_t rvswd_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value)
 
     return (parity == parity_read) ? RVSWD_OK : RVSWD_FAIL;
 }
+
+rvswd_transport_t const rvswd_transport_gpio = {
+    .name  = "gpio",
+    .init  = rvswd_gpio_init,
+    .reset = rvswd_gpio_reset,
+    .write = rvswd_gpio_write,
+    .read  = rvswd_gpio_read,
+};
+
+rvswd_transport_t const rvswd_transport_gpio_direct = {
+    .name  = "gpio-direct",
+    .init  = rvswd_gpio_init,
+    .reset = rvswd_gpio_reset,
+    .write = rvswd_gpio_write,
+    .read  = rvswd_gpio_read,
+};
+
+static inline rvswd_transport_t const *rvswd_transport(rvswd_handle_t *handle) {
+    if (handle->transport == NULL) {
+        handle->transport = &rvswd_transport_gpio;
+    }
+    return handle->transport;
+}
+
+rvswd_result_t rvswd_init(rvswd_handle_t *handle) {
+    rvswd_transport_t const *transport = rvswd_transport(handle);
+    rvswd_progbuf_invalidate(handle);
+    rvswd_gpr_invalidate(handle);
+    memset(&handle->target, 0, sizeof(handle->target));
+    return transport->init ? transport->init(handle) : rvswd_gpio_init(handle);
+}
+
+rvswd_result_t rvswd_reset(rvswd_handle_t *handle) {
+    rvswd_transport_t const *transport = rvswd_transport(handle);
+    rvswd_progbuf_invalidate(handle);
+    rvswd_gpr_invalidate(handle);
+    return transport->reset ? transport->reset(handle) : rvswd_gpio_reset(handle);
+}
+
+rvswd_result_t rvswd_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+    rvswd_result_t res = rvswd_transport(handle)->write(handle, reg, value);
+    handle->stats.writes++;
+    if (res != RVSWD_OK) {
+        handle->stats.errors++;
+    }
+    return res;
+}
+
+rvswd_result_t rvswd_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+    rvswd_result_t res = rvswd_transport(handle)->read(handle, reg, value);
+    handle->stats.reads++;
+    if (res != RVSWD_OK) {
+        handle->stats.errors++;
+    }
+    return res;
+}
+
+void rvswd_progbuf_invalidate(rvswd_handle_t *handle) {
+    handle->progbuf.valid = 0;
+}
+
+void rvswd_gpr_invalidate(rvswd_handle_t *handle) {
+    handle->gpr.valid = 0;
+}
+
+rvswd_result_t rvswd_transfer(rvswd_handle_t *handle, rvswd_op_t *ops, size_t count) {
+    rvswd_transport_t const *transport = rvswd_transport(handle);
+    if (transport->batch) {
+        for (size_t i = 0; i < count; i++) {
+            if (ops[i].write) {
+                handle->stats.writes++;
+            } else {
+                handle->stats.reads++;
+            }
+        }
+        rvswd_result_t res = transport->batch(handle, ops, count);
+        if (res != RVSWD_OK) {
+            handle->stats.errors++;
+        }
+        return res;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        rvswd_result_t res;
+        if (ops[i].write) {
+            res = rvswd_write(handle, ops[i].reg, ops[i].value);
+        } else {
+            uint32_t value = 0;
+            res            = rvswd_read(handle, ops[i].reg, &value);
+            if (ops[i].result) {
+                *ops[i].result = value;
+            }
+        }
+        if (res != RVSWD_OK) {
+            return res;
+        }
+    }
+    return RVSWD_OK;
+}
+
+void rvswd_batch_init(rvswd_batch_t *batch, rvswd_op_t *ops, size_t capacity) {
+    batch->ops      = ops;
+    batch->capacity = capacity;
+    batch->count    = 0;
+}
+
+rvswd_result_t rvswd_batch_write(rvswd_batch_t *batch, uint8_t reg, uint32_t value) {
+    if (batch->count >= batch->capacity) {
+        return RVSWD_INVALID_ARGS;
+    }
+    batch->ops[batch->count++] = (rvswd_op_t){
+        .reg   = reg,
+        .write = true,
+        .value = value,
+    };
+    return RVSWD_OK;
+}
+
+rvswd_result_t rvswd_batch_read(rvswd_batch_t *batch, uint8_t reg, uint32_t *result) {
+    if (batch->count >= batch->capacity) {
+        return RVSWD_INVALID_ARGS;
+    }
+    batch->ops[batch->count++] = (rvswd_op_t){
+        .reg    = reg,
+        .write  = false,
+        .result = result,
+    };
+    return RVSWD_OK;
+}
+
+rvswd_result_t rvswd_batch_submit(rvswd_handle_t *handle, rvswd_batch_t *batch) {
+    rvswd_result_t res = rvswd_transfer(handle, batch->ops, batch->count);
+    batch->count       = 0;
+    return res;
+}
+
+rvswd_result_t rvswd_measure_bitrate(rvswd_handle_t *handle, uint8_t reg, uint32_t count, uint32_t *bits_per_second) {
+    if (count == 0 || bits_per_second == NULL) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    uint32_t       value;
+    rvswd_result_t res   = RVSWD_OK;
+    int64_t        start = esp_timer_get_time();
+    for (uint32_t i = 0; i < count; i++) {
+        res = rvswd_read(handle, reg, &value);
+        if (res != RVSWD_OK) {
+            break;
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    if (elapsed <= 0) {
+        elapsed = 1;
+    }
+    *bits_per_second = (uint32_t)((uint64_t)RVSWD_FRAME_BITS * count * 1000000 / elapsed);
+    return res;
+}
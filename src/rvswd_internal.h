@@ -0,0 +1,19 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "rvswd.h"
+
+#include <stdbool.h>
+
+// Bit-bang engine, also used by the peripheral transports for pin setup and conditions they cannot generate.
+rvswd_result_t rvswd_gpio_init(rvswd_handle_t *handle);
+rvswd_result_t rvswd_gpio_reset(rvswd_handle_t *handle);
+rvswd_result_t rvswd_start(rvswd_handle_t *handle);
+rvswd_result_t rvswd_stop(rvswd_handle_t *handle);
+void           rvswd_write_bit(rvswd_handle_t *handle, bool value);
+bool           rvswd_read_bit(rvswd_handle_t *handle);
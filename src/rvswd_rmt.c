@@ -0,0 +1,430 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "rvswd_rmt.h"
+
+#include "rvswd_internal.h"
+#include "soc/soc_caps.h"
+
+static rvswd_result_t rvswd_rmt_init(rvswd_handle_t *handle);
+static rvswd_result_t rvswd_rmt_reset(rvswd_handle_t *handle);
+static rvswd_result_t rvswd_rmt_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value);
+static rvswd_result_t rvswd_rmt_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value);
+
+// The pins belong to the RMT channels, so init must not hand them back to the GPIO matrix.
+rvswd_transport_t const rvswd_transport_rmt = {
+    .name  = "rmt",
+    .init  = rvswd_rmt_init,
+    .reset = rvswd_rmt_reset,
+    .write = rvswd_rmt_write,
+    .read  = rvswd_rmt_read,
+};
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+
+#include "driver/rmt_rx.h"
+#include "driver/rmt_tx.h"
+#include "esp_attr.h"
+#include "freertos/queue.h"
+
+#include <stdlib.h>
+
+// Enough symbols for a 100 clock reset sequence, the longest stream we generate.
+#define RVSWD_RMT_TX_SYMBOLS 128
+#define RVSWD_RMT_RX_SYMBOLS SOC_RMT_MEM_WORDS_PER_CHANNEL
+#define RVSWD_RMT_MAX_TICKS  32767
+
+// Run-length encoder turning a sequence of (level, duration) steps into RMT symbols.
+typedef struct rvswd_rmt_stream {
+    rmt_symbol_word_t symbols[RVSWD_RMT_TX_SYMBOLS];
+    size_t            count;
+    bool              half;  // The first half of symbols[count] is in use.
+    bool              level; // Level of the run that is still being extended.
+    uint32_t          ticks; // Length of the run that is still being extended.
+} rvswd_rmt_stream_t;
+
+typedef struct rvswd_rmt_ctx {
+    rvswd_rmt_config_t        config;
+    rmt_channel_handle_t      swclk_chan;
+    rmt_channel_handle_t      swdio_chan;
+    rmt_channel_handle_t      rx_chan;
+    rmt_encoder_handle_t      swclk_encoder;
+    rmt_encoder_handle_t      swdio_encoder;
+    rmt_sync_manager_handle_t sync;
+    QueueHandle_t             rx_queue;
+    rvswd_rmt_stream_t        swclk;
+    rvswd_rmt_stream_t        swdio;
+    rmt_symbol_word_t         rx_symbols[RVSWD_RMT_RX_SYMBOLS];
+} rvswd_rmt_ctx_t;
+
+static void rvswd_rmt_stream_push(rvswd_rmt_stream_t *stream, bool level, uint16_t ticks) {
+    if (stream->count >= RVSWD_RMT_TX_SYMBOLS) {
+        return;
+    }
+    rmt_symbol_word_t *symbol = &stream->symbols[stream->count];
+    if (!stream->half) {
+        symbol->level0    = level;
+        symbol->duration0 = ticks;
+        stream->half      = true;
+    } else {
+        symbol->level1    = level;
+        symbol->duration1 = ticks;
+        stream->half      = false;
+        stream->count++;
+    }
+}
+
+static void rvswd_rmt_stream_flush(rvswd_rmt_stream_t *stream) {
+    while (stream->ticks > RVSWD_RMT_MAX_TICKS) {
+        rvswd_rmt_stream_push(stream, stream->level, RVSWD_RMT_MAX_TICKS);
+        stream->ticks -= RVSWD_RMT_MAX_TICKS;
+    }
+    if (stream->ticks) {
+        rvswd_rmt_stream_push(stream, stream->level, stream->ticks);
+        stream->ticks = 0;
+    }
+}
+
+static void rvswd_rmt_stream_run(rvswd_rmt_stream_t *stream, bool level, uint32_t ticks) {
+    if (stream->ticks && stream->level == level) {
+        stream->ticks += ticks;
+        return;
+    }
+    rvswd_rmt_stream_flush(stream);
+    stream->level = level;
+    stream->ticks = ticks;
+}
+
+static size_t rvswd_rmt_stream_finish(rvswd_rmt_stream_t *stream) {
+    rvswd_rmt_stream_flush(stream);
+    if (stream->half) {
+        // A zero duration would end the transmission early, pad with one tick of the final level instead.
+        rvswd_rmt_stream_push(stream, stream->symbols[stream->count].level0, 1);
+    }
+    return stream->count;
+}
+
+// Emit one step of the waveform on both lines.
+static void rvswd_rmt_emit(rvswd_rmt_ctx_t *ctx, bool swclk, bool swdio, uint32_t ticks) {
+    rvswd_rmt_stream_run(&ctx->swclk, swclk, ticks);
+    rvswd_rmt_stream_run(&ctx->swdio, swdio, ticks);
+}
+
+static void rvswd_rmt_begin(rvswd_rmt_ctx_t *ctx) {
+    ctx->swclk.count = 0;
+    ctx->swclk.half  = false;
+    ctx->swclk.ticks = 0;
+    ctx->swdio.count = 0;
+    ctx->swdio.half  = false;
+    ctx->swdio.ticks = 0;
+}
+
+static void rvswd_rmt_emit_start(rvswd_rmt_ctx_t *ctx) {
+    rvswd_rmt_emit(ctx, true, true, ctx->config.hold_ticks);
+    rvswd_rmt_emit(ctx, true, false, ctx->config.hold_ticks); // SWDIO falls while SWCLK is high
+}
+
+static void rvswd_rmt_emit_stop(rvswd_rmt_ctx_t *ctx) {
+    rvswd_rmt_emit(ctx, true, false, ctx->config.hold_ticks);
+    rvswd_rmt_emit(ctx, true, true, ctx->config.hold_ticks); // SWDIO rises while SWCLK is high
+}
+
+// Emit `count` bits of `value`, MSB first. The target samples SWDIO on the rising edge of SWCLK.
+static void rvswd_rmt_emit_bits(rvswd_rmt_ctx_t *ctx, uint32_t value, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        bool bit = (value >> (count - 1 - i)) & 1;
+        rvswd_rmt_emit(ctx, false, bit, ctx->config.half_period_ticks);
+        rvswd_rmt_emit(ctx, true, bit, ctx->config.half_period_ticks);
+    }
+}
+
+static bool IRAM_ATTR rvswd_rmt_rx_done(rmt_channel_handle_t channel, rmt_rx_done_event_data_t const *edata,
+                                        void *user_ctx) {
+    QueueHandle_t queue = user_ctx;
+    BaseType_t    woken = pdFALSE;
+    size_t        count = edata->num_symbols;
+    xQueueSendFromISR(queue, &count, &woken);
+    return woken == pdTRUE;
+}
+
+// Play the encoded streams on both TX channels at once, optionally capturing SWDIO.
+static rvswd_result_t rvswd_rmt_play(rvswd_rmt_ctx_t *ctx, size_t *rx_count) {
+    size_t swclk_count = rvswd_rmt_stream_finish(&ctx->swclk);
+    size_t swdio_count = rvswd_rmt_stream_finish(&ctx->swdio);
+
+    if (rx_count) {
+        uint32_t tick_ns    = 1000000000UL / ctx->config.resolution_hz;
+        // Longer than the longest constant SWDIO level in a read frame, so only the final idle ends the capture.
+        uint32_t idle_ticks = ctx->config.half_period_ticks * 2 * 48 + ctx->config.hold_ticks * 2;
+        if (idle_ticks > RVSWD_RMT_MAX_TICKS) {
+            idle_ticks = RVSWD_RMT_MAX_TICKS;
+        }
+        rmt_receive_config_t rx_cfg = {
+            .signal_range_min_ns = tick_ns / 2,
+            .signal_range_max_ns = idle_ticks * tick_ns,
+        };
+        if (rmt_receive(ctx->rx_chan, ctx->rx_symbols, sizeof(ctx->rx_symbols), &rx_cfg) != ESP_OK) {
+            return RVSWD_FAIL;
+        }
+    }
+
+    rmt_transmit_config_t tx_cfg = {
+        .loop_count      = 0,
+        .flags.eot_level = 1,
+    };
+    rmt_sync_reset(ctx->sync);
+    if (rmt_transmit(ctx->swclk_chan, ctx->swclk_encoder, ctx->swclk.symbols, swclk_count * sizeof(rmt_symbol_word_t),
+                     &tx_cfg) != ESP_OK ||
+        rmt_transmit(ctx->swdio_chan, ctx->swdio_encoder, ctx->swdio.symbols, swdio_count * sizeof(rmt_symbol_word_t),
+                     &tx_cfg) != ESP_OK) {
+        return RVSWD_FAIL;
+    }
+    if (rmt_tx_wait_all_done(ctx->swclk_chan, 100) != ESP_OK || rmt_tx_wait_all_done(ctx->swdio_chan, 100) != ESP_OK) {
+        return RVSWD_FAIL;
+    }
+
+    if (rx_count && xQueueReceive(ctx->rx_queue, rx_count, pdMS_TO_TICKS(10) + 1) != pdTRUE) {
+        return RVSWD_FAIL;
+    }
+    return RVSWD_OK;
+}
+
+// Level of the captured SWDIO line `ticks` after the first edge, which is the falling edge of the start condition.
+static bool rvswd_rmt_level_at(rvswd_rmt_ctx_t *ctx, size_t count, uint32_t ticks) {
+    uint32_t elapsed = 0;
+    for (size_t i = 0; i < count; i++) {
+        rmt_symbol_word_t const *symbol = &ctx->rx_symbols[i];
+        elapsed += symbol->duration0;
+        if (ticks < elapsed) {
+            return symbol->level0;
+        }
+        if (symbol->duration1 == 0) {
+            break;
+        }
+        elapsed += symbol->duration1;
+        if (ticks < elapsed) {
+            return symbol->level1;
+        }
+    }
+    return true; // Idle
+}
+
+rvswd_result_t rvswd_rmt_attach(rvswd_handle_t *handle, rvswd_rmt_config_t const *config) {
+    if (handle == NULL || config == NULL || handle->transport_ctx != NULL || config->resolution_hz == 0 ||
+        config->half_period_ticks == 0 || config->hold_ticks == 0) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    rvswd_rmt_ctx_t *ctx = calloc(1, sizeof(rvswd_rmt_ctx_t));
+    if (ctx == NULL) {
+        return RVSWD_FAIL;
+    }
+    ctx->config   = *config;
+    ctx->rx_queue = xQueueCreate(1, sizeof(size_t));
+    if (ctx->rx_queue == NULL) {
+        free(ctx);
+        return RVSWD_FAIL;
+    }
+
+    // The RX channel configures SWDIO as an input, so it goes first and the TX channel adds its output on top.
+    rmt_rx_channel_config_t rx_cfg = {
+        .gpio_num          = handle->swdio,
+        .clk_src           = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz     = config->resolution_hz,
+        .mem_block_symbols = RVSWD_RMT_RX_SYMBOLS,
+    };
+    esp_err_t res = rmt_new_rx_channel(&rx_cfg, &ctx->rx_chan);
+
+    rmt_tx_channel_config_t tx_cfg = {
+        .gpio_num          = handle->swclk,
+        .clk_src           = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz     = config->resolution_hz,
+        .mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL,
+        .trans_queue_depth = 1,
+    };
+    if (res == ESP_OK) {
+        res = rmt_new_tx_channel(&tx_cfg, &ctx->swclk_chan);
+    }
+
+    if (res == ESP_OK) {
+        // SWDIO is open drain and looped back so the RX channel sees both our bits and the target's.
+        tx_cfg.gpio_num           = handle->swdio;
+        tx_cfg.flags.io_od_mode   = true;
+        tx_cfg.flags.io_loop_back = true;
+        res                       = rmt_new_tx_channel(&tx_cfg, &ctx->swdio_chan);
+    }
+
+    if (res == ESP_OK) {
+        rmt_rx_event_callbacks_t callbacks = {
+            .on_recv_done = rvswd_rmt_rx_done,
+        };
+        res = rmt_rx_register_event_callbacks(ctx->rx_chan, &callbacks, ctx->rx_queue);
+    }
+
+    rmt_copy_encoder_config_t encoder_cfg = {};
+    if (res == ESP_OK) {
+        res = rmt_new_copy_encoder(&encoder_cfg, &ctx->swclk_encoder);
+    }
+    if (res == ESP_OK) {
+        res = rmt_new_copy_encoder(&encoder_cfg, &ctx->swdio_encoder);
+    }
+
+    if (res == ESP_OK) {
+        res = rmt_enable(ctx->swclk_chan);
+    }
+    if (res == ESP_OK) {
+        res = rmt_enable(ctx->swdio_chan);
+    }
+    if (res == ESP_OK) {
+        res = rmt_enable(ctx->rx_chan);
+    }
+
+    if (res == ESP_OK) {
+        rmt_channel_handle_t      channels[] = {ctx->swclk_chan, ctx->swdio_chan};
+        rmt_sync_manager_config_t sync_cfg   = {
+            .tx_channel_array = channels,
+            .array_size       = 2,
+        };
+        res = rmt_new_sync_manager(&sync_cfg, &ctx->sync);
+    }
+
+    handle->transport     = &rvswd_transport_rmt;
+    handle->transport_ctx = ctx;
+
+    if (res != ESP_OK) {
+        rvswd_rmt_detach(handle);
+        return RVSWD_FAIL;
+    }
+
+    // Bring both lines to their idle high level.
+    rvswd_rmt_begin(ctx);
+    rvswd_rmt_emit(ctx, true, true, config->hold_ticks);
+    return rvswd_rmt_play(ctx, NULL);
+}
+
+rvswd_result_t rvswd_rmt_detach(rvswd_handle_t *handle) {
+    if (handle == NULL || handle->transport != &rvswd_transport_rmt) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    rvswd_rmt_ctx_t *ctx = handle->transport_ctx;
+    if (ctx->sync) {
+        rmt_del_sync_manager(ctx->sync);
+    }
+    rmt_channel_handle_t channels[] = {ctx->swclk_chan, ctx->swdio_chan, ctx->rx_chan};
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        if (channels[i]) {
+            rmt_disable(channels[i]);
+            rmt_del_channel(channels[i]);
+        }
+    }
+    if (ctx->swclk_encoder) {
+        rmt_del_encoder(ctx->swclk_encoder);
+    }
+    if (ctx->swdio_encoder) {
+        rmt_del_encoder(ctx->swdio_encoder);
+    }
+    vQueueDelete(ctx->rx_queue);
+    free(ctx);
+
+    handle->transport     = &rvswd_transport_gpio_direct;
+    handle->transport_ctx = NULL;
+    return rvswd_init(handle);
+}
+
+static rvswd_result_t rvswd_rmt_init(rvswd_handle_t *handle) {
+    return handle->transport_ctx ? RVSWD_OK : RVSWD_INVALID_ARGS;
+}
+
+static rvswd_result_t rvswd_rmt_reset(rvswd_handle_t *handle) {
+    rvswd_rmt_ctx_t *ctx = handle->transport_ctx;
+
+    rvswd_rmt_begin(ctx);
+    for (uint8_t i = 0; i < 100; i++) {
+        rvswd_rmt_emit(ctx, false, true, ctx->config.half_period_ticks);
+        rvswd_rmt_emit(ctx, true, true, ctx->config.half_period_ticks);
+    }
+    rvswd_rmt_emit_stop(ctx);
+    return rvswd_rmt_play(ctx, NULL);
+}
+
+static rvswd_result_t rvswd_rmt_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+    rvswd_rmt_ctx_t *ctx = handle->transport_ctx;
+
+    rvswd_rmt_begin(ctx);
+    rvswd_rmt_emit_start(ctx);
+    rvswd_rmt_emit_bits(ctx, reg, 7);
+    rvswd_rmt_emit_bits(ctx, 1, 1);
+    rvswd_rmt_emit_bits(ctx, !__builtin_parity(reg & 0x7F), 1);
+    rvswd_rmt_emit_bits(ctx, 0b10101, 5);
+    rvswd_rmt_emit_bits(ctx, value, 32);
+    rvswd_rmt_emit_bits(ctx, __builtin_parity(value), 1);
+    rvswd_rmt_emit_bits(ctx, 0b10111, 5);
+    rvswd_rmt_emit_stop(ctx);
+    return rvswd_rmt_play(ctx, NULL);
+}
+
+static rvswd_result_t rvswd_rmt_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+    rvswd_rmt_ctx_t *ctx = handle->transport_ctx;
+
+    rvswd_rmt_begin(ctx);
+    rvswd_rmt_emit_start(ctx);
+    rvswd_rmt_emit_bits(ctx, reg, 7);
+    rvswd_rmt_emit_bits(ctx, 0, 1);
+    rvswd_rmt_emit_bits(ctx, __builtin_parity(reg & 0x7F), 1);
+    rvswd_rmt_emit_bits(ctx, 0b10101, 5);
+    rvswd_rmt_emit_bits(ctx, 0xFFFFFFFF, 32); // Released, the target drives data and parity
+    rvswd_rmt_emit_bits(ctx, 1, 1);
+    rvswd_rmt_emit_bits(ctx, 0b10111, 5);
+    rvswd_rmt_emit_stop(ctx);
+
+    size_t         count;
+    rvswd_result_t res = rvswd_rmt_play(ctx, &count);
+    if (res != RVSWD_OK) {
+        return res;
+    }
+
+    // Sample each returned bit halfway through the high phase of SWCLK. Bit 14 is the first data bit.
+    uint32_t half  = ctx->config.half_period_ticks;
+    uint32_t first = ctx->config.hold_ticks + 14 * 2 * half + half + half / 2;
+    *value         = 0;
+    for (uint8_t position = 0; position < 32; position++) {
+        if (rvswd_rmt_level_at(ctx, count, first + position * 2 * half)) {
+            *value |= 1UL << (31 - position);
+        }
+    }
+    bool parity_read = rvswd_rmt_level_at(ctx, count, first + 32 * 2 * half);
+
+    return (__builtin_parity(*value) == parity_read) ? RVSWD_OK : RVSWD_FAIL;
+}
+
+#else
+
+static rvswd_result_t rvswd_rmt_init(rvswd_handle_t *handle) {
+    return RVSWD_FAIL;
+}
+
+rvswd_result_t rvswd_rmt_attach(rvswd_handle_t *handle, rvswd_rmt_config_t const *config) {
+    return RVSWD_FAIL;
+}
+
+rvswd_result_t rvswd_rmt_detach(rvswd_handle_t *handle) {
+    return RVSWD_INVALID_ARGS;
+}
+
+static rvswd_result_t rvswd_rmt_reset(rvswd_handle_t *handle) {
+    return RVSWD_FAIL;
+}
+
+static rvswd_result_t rvswd_rmt_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+    return RVSWD_FAIL;
+}
+
+static rvswd_result_t rvswd_rmt_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+    return RVSWD_FAIL;
+}
+
+#endif
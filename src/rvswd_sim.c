@@ -0,0 +1,497 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "rvswd_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RVSWD_SIM_DATA0        0x04
+#define RVSWD_SIM_DATA1        0x05
+#define RVSWD_SIM_DMCONTROL    0x10
+#define RVSWD_SIM_DMSTATUS     0x11
+#define RVSWD_SIM_HARTINFO     0x12
+#define RVSWD_SIM_ABSTRACTCS   0x16
+#define RVSWD_SIM_COMMAND      0x17
+#define RVSWD_SIM_ABSTRACTAUTO 0x18
+#define RVSWD_SIM_PROGBUF0     0x20
+#define RVSWD_SIM_PROGBUF7     0x27
+
+#define RVSWD_SIM_CSR_DCSR 0x7B0
+#define RVSWD_SIM_CSR_DPC  0x7B1
+
+#define RVSWD_SIM_DCSR_EBREAKM (1 << 15)
+
+// Address the program buffer executes from, and the hart-visible DATA0/DATA1 registers (HARTINFO.dataaddr).
+#define RVSWD_SIM_PROGBUF_BASE 0xE0000380
+#define RVSWD_SIM_DATA_BASE    0xE00000F4
+
+#define RVSWD_SIM_CMDERR_NONE       0
+#define RVSWD_SIM_CMDERR_EXCEPTION  3
+#define RVSWD_SIM_CMDERR_HALTRESUME 4
+
+// Upper bound on instructions executed by a single program buffer run.
+#define RVSWD_SIM_PROGBUF_STEPS 1024
+#define RVSWD_SIM_RUN_SLICE     4096
+
+typedef enum rvswd_sim_step {
+    RVSWD_SIM_STEP_OK,
+    RVSWD_SIM_STEP_EBREAK,
+    RVSWD_SIM_STEP_ILLEGAL,
+} rvswd_sim_step_t;
+
+typedef struct rvswd_sim_ctx {
+    rvswd_sim_config_t config;
+
+    // Debug module
+    uint32_t data[2];
+    uint32_t dmcontrol;
+    uint32_t command;
+    uint32_t abstractauto;
+    uint32_t progbuf[8];
+    uint8_t  cmderr;
+    bool     halted;
+    bool     resumeack;
+    bool     havereset;
+    bool     stalled; // Running hart hit an instruction it cannot execute.
+
+    // Hart
+    uint32_t x[32];
+    uint32_t pc;
+    uint32_t dpc;
+    uint32_t dcsr;
+    uint32_t csr[16]; // Small store for CSRs the model does not interpret, indexed by the low bits.
+} rvswd_sim_ctx_t;
+
+static uint32_t rvswd_sim_load_word(rvswd_sim_ctx_t *ctx, uint32_t address) {
+    address &= ~3UL;
+    if (address >= RVSWD_SIM_PROGBUF_BASE && address < RVSWD_SIM_PROGBUF_BASE + sizeof(ctx->progbuf)) {
+        return ctx->progbuf[(address - RVSWD_SIM_PROGBUF_BASE) / 4];
+    }
+    if (address == RVSWD_SIM_DATA_BASE || address == RVSWD_SIM_DATA_BASE + 4) {
+        return ctx->data[(address - RVSWD_SIM_DATA_BASE) / 4];
+    }
+    return ctx->config.read_memory ? ctx->config.read_memory(ctx->config.user, address) : 0;
+}
+
+static void rvswd_sim_store_word(rvswd_sim_ctx_t *ctx, uint32_t address, uint32_t value) {
+    address &= ~3UL;
+    if (address == RVSWD_SIM_DATA_BASE || address == RVSWD_SIM_DATA_BASE + 4) {
+        ctx->data[(address - RVSWD_SIM_DATA_BASE) / 4] = value;
+        return;
+    }
+    if (ctx->config.write_memory) {
+        ctx->config.write_memory(ctx->config.user, address, value);
+    }
+}
+
+static uint32_t rvswd_sim_load(rvswd_sim_ctx_t *ctx, uint32_t address, uint8_t size, bool sign) {
+    uint32_t word  = rvswd_sim_load_word(ctx, address) >> ((address & 3) * 8);
+    uint32_t value = (size == 4) ? word : word & ((1UL << (size * 8)) - 1);
+    if (sign && size < 4 && (value & (1UL << (size * 8 - 1)))) {
+        value |= ~((1UL << (size * 8)) - 1);
+    }
+    return value;
+}
+
+static void rvswd_sim_store(rvswd_sim_ctx_t *ctx, uint32_t address, uint32_t value, uint8_t size) {
+    if (size == 4) {
+        rvswd_sim_store_word(ctx, address, value);
+        return;
+    }
+    uint32_t shift = (address & 3) * 8;
+    uint32_t mask  = ((1UL << (size * 8)) - 1) << shift;
+    uint32_t word  = rvswd_sim_load_word(ctx, address);
+    rvswd_sim_store_word(ctx, address, (word & ~mask) | ((value << shift) & mask));
+}
+
+static uint32_t *rvswd_sim_csr(rvswd_sim_ctx_t *ctx, uint16_t csr) {
+    if (csr == RVSWD_SIM_CSR_DCSR) {
+        return &ctx->dcsr;
+    } else if (csr == RVSWD_SIM_CSR_DPC) {
+        return &ctx->dpc;
+    }
+    return &ctx->csr[csr & 0xF];
+}
+
+static inline void rvswd_sim_set(rvswd_sim_ctx_t *ctx, uint8_t rd, uint32_t value) {
+    if (rd) {
+        ctx->x[rd] = value;
+    }
+}
+
+static inline int32_t rvswd_sim_sext(uint32_t value, uint8_t bits) {
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static rvswd_sim_step_t rvswd_sim_step_compressed(rvswd_sim_ctx_t *ctx, uint16_t inst) {
+    uint8_t  quadrant = inst & 3;
+    uint8_t  funct3   = inst >> 13;
+    uint8_t  rd       = (inst >> 7) & 0x1F;
+    uint8_t  rs2      = (inst >> 2) & 0x1F;
+    uint8_t  rd_c     = 8 + ((inst >> 2) & 7); // rd' / rs2'
+    uint8_t  rs1_c    = 8 + ((inst >> 7) & 7); // rs1'
+    uint32_t next     = ctx->pc + 2;
+
+    if (quadrant == 0 && (funct3 == 2 || funct3 == 6)) { // C.LW / C.SW
+        uint32_t offset = ((inst >> 4) & 4) | ((inst >> 7) & 0x38) | ((inst << 1) & 0x40);
+        if (funct3 == 2) {
+            rvswd_sim_set(ctx, rd_c, rvswd_sim_load(ctx, ctx->x[rs1_c] + offset, 4, false));
+        } else {
+            rvswd_sim_store(ctx, ctx->x[rs1_c] + offset, ctx->x[rd_c], 4);
+        }
+    } else if (quadrant == 1 && (funct3 == 0 || funct3 == 2)) { // C.ADDI / C.NOP / C.LI
+        int32_t imm = rvswd_sim_sext(((inst >> 7) & 0x20) | ((inst >> 2) & 0x1F), 6);
+        rvswd_sim_set(ctx, rd, (funct3 == 0 ? ctx->x[rd] : 0) + imm);
+    } else if (quadrant == 1 && funct3 == 5) { // C.J
+        uint32_t imm = ((inst >> 1) & 0x800) | ((inst >> 7) & 0x10) | ((inst >> 1) & 0x300) | ((inst << 2) & 0x400) |
+                       ((inst >> 1) & 0x40) | ((inst << 1) & 0x80) | ((inst >> 2) & 0xE) | ((inst << 3) & 0x20);
+        next = ctx->pc + rvswd_sim_sext(imm, 12);
+    } else if (quadrant == 1 && (funct3 == 6 || funct3 == 7)) { // C.BEQZ / C.BNEZ
+        uint32_t imm = ((inst >> 4) & 0x100) | ((inst >> 7) & 0x18) | ((inst << 1) & 0xC0) | ((inst >> 2) & 0x6) |
+                       ((inst << 3) & 0x20);
+        if ((ctx->x[rs1_c] == 0) == (funct3 == 6)) {
+            next = ctx->pc + rvswd_sim_sext(imm, 9);
+        }
+    } else if (quadrant == 2 && funct3 == 4) { // C.MV / C.ADD / C.EBREAK / C.JR
+        bool bit12 = (inst >> 12) & 1;
+        if (bit12 && rd == 0 && rs2 == 0) {
+            return RVSWD_SIM_STEP_EBREAK;
+        } else if (rs2 == 0) {
+            if (bit12) {
+                rvswd_sim_set(ctx, 1, next);
+            }
+            next = ctx->x[rd] & ~1UL;
+        } else {
+            rvswd_sim_set(ctx, rd, (bit12 ? ctx->x[rd] : 0) + ctx->x[rs2]);
+        }
+    } else {
+        return RVSWD_SIM_STEP_ILLEGAL;
+    }
+
+    ctx->pc = next;
+    return RVSWD_SIM_STEP_OK;
+}
+
+static rvswd_sim_step_t rvswd_sim_step(rvswd_sim_ctx_t *ctx) {
+    uint32_t inst = rvswd_sim_load(ctx, ctx->pc, 2, false);
+    if ((inst & 3) != 3) {
+        return rvswd_sim_step_compressed(ctx, inst);
+    }
+    inst |= rvswd_sim_load(ctx, ctx->pc + 2, 2, false) << 16;
+
+    uint8_t  opcode = inst & 0x7F;
+    uint8_t  rd     = (inst >> 7) & 0x1F;
+    uint8_t  funct3 = (inst >> 12) & 7;
+    uint32_t rs1    = ctx->x[(inst >> 15) & 0x1F];
+    uint32_t rs2    = ctx->x[(inst >> 20) & 0x1F];
+    int32_t  imm_i  = (int32_t)inst >> 20;
+    int32_t  imm_s  = ((int32_t)inst >> 25 << 5) | ((inst >> 7) & 0x1F);
+    uint32_t next   = ctx->pc + 4;
+
+    switch (opcode) {
+        case 0x37: // LUI
+            rvswd_sim_set(ctx, rd, inst & 0xFFFFF000);
+            break;
+        case 0x17: // AUIPC
+            rvswd_sim_set(ctx, rd, ctx->pc + (inst & 0xFFFFF000));
+            break;
+        case 0x6F: { // JAL
+            uint32_t imm = (inst & 0xFF000) | ((inst >> 9) & 0x800) | ((inst >> 20) & 0x7FE) | ((inst >> 11) & 0x100000);
+            rvswd_sim_set(ctx, rd, next);
+            next = ctx->pc + rvswd_sim_sext(imm, 21);
+            break;
+        }
+        case 0x67: // JALR
+            rvswd_sim_set(ctx, rd, next);
+            next = (rs1 + imm_i) & ~1UL;
+            break;
+        case 0x63: { // Branches
+            uint32_t imm   = ((inst >> 7) & 0x1E) | ((inst >> 20) & 0x7E0) | ((inst << 4) & 0x800) | ((inst >> 19) & 0x1000);
+            bool     taken = false;
+            switch (funct3) {
+                case 0: taken = rs1 == rs2; break;
+                case 1: taken = rs1 != rs2; break;
+                case 4: taken = (int32_t)rs1 < (int32_t)rs2; break;
+                case 5: taken = (int32_t)rs1 >= (int32_t)rs2; break;
+                case 6: taken = rs1 < rs2; break;
+                case 7: taken = rs1 >= rs2; break;
+                default: return RVSWD_SIM_STEP_ILLEGAL;
+            }
+            if (taken) {
+                next = ctx->pc + rvswd_sim_sext(imm, 13);
+            }
+            break;
+        }
+        case 0x03: // Loads
+            switch (funct3) {
+                case 0: rvswd_sim_set(ctx, rd, rvswd_sim_load(ctx, rs1 + imm_i, 1, true)); break;
+                case 1: rvswd_sim_set(ctx, rd, rvswd_sim_load(ctx, rs1 + imm_i, 2, true)); break;
+                case 2: rvswd_sim_set(ctx, rd, rvswd_sim_load(ctx, rs1 + imm_i, 4, false)); break;
+                case 4: rvswd_sim_set(ctx, rd, rvswd_sim_load(ctx, rs1 + imm_i, 1, false)); break;
+                case 5: rvswd_sim_set(ctx, rd, rvswd_sim_load(ctx, rs1 + imm_i, 2, false)); break;
+                default: return RVSWD_SIM_STEP_ILLEGAL;
+            }
+            break;
+        case 0x23: // Stores
+            if (funct3 > 2) {
+                return RVSWD_SIM_STEP_ILLEGAL;
+            }
+            rvswd_sim_store(ctx, rs1 + imm_s, rs2, 1 << funct3);
+            break;
+        case 0x13:   // Register-immediate
+        case 0x33: { // Register-register
+            bool     reg   = opcode == 0x33;
+            uint32_t b     = reg ? rs2 : (uint32_t)imm_i;
+            bool     alt   = (inst >> 30) & 1;
+            uint32_t value = 0;
+            if (reg && (inst >> 25) & ~0x20) {
+                return RVSWD_SIM_STEP_ILLEGAL; // No M extension
+            }
+            switch (funct3) {
+                case 0: value = (reg && alt) ? rs1 - b : rs1 + b; break;
+                case 1: value = rs1 << (b & 0x1F); break;
+                case 2: value = (int32_t)rs1 < (int32_t)b; break;
+                case 3: value = rs1 < b; break;
+                case 4: value = rs1 ^ b; break;
+                case 5: value = alt ? (uint32_t)((int32_t)rs1 >> (b & 0x1F)) : rs1 >> (b & 0x1F); break;
+                case 6: value = rs1 | b; break;
+                case 7: value = rs1 & b; break;
+            }
+            rvswd_sim_set(ctx, rd, value);
+            break;
+        }
+        case 0x0F: // FENCE
+            break;
+        case 0x73: { // SYSTEM
+            if (inst == 0x00100073) {
+                return RVSWD_SIM_STEP_EBREAK;
+            }
+            if (funct3 == 0 || funct3 == 4) {
+                return RVSWD_SIM_STEP_ILLEGAL;
+            }
+            uint32_t *csr     = rvswd_sim_csr(ctx, inst >> 20);
+            uint32_t  operand = (funct3 & 4) ? (inst >> 15) & 0x1F : rs1;
+            uint32_t  old     = *csr;
+            switch (funct3 & 3) {
+                case 1: *csr = operand; break;
+                case 2: *csr = old | operand; break;
+                case 3: *csr = old & ~operand; break;
+            }
+            rvswd_sim_set(ctx, rd, old);
+            break;
+        }
+        default:
+            return RVSWD_SIM_STEP_ILLEGAL;
+    }
+
+    ctx->pc = next;
+    return RVSWD_SIM_STEP_OK;
+}
+
+// Let a running hart make progress, as it would while the debugger is busy on the wire.
+static void rvswd_sim_run(rvswd_sim_ctx_t *ctx) {
+    if (ctx->halted || ctx->stalled) {
+        return;
+    }
+    for (uint32_t i = 0; i < ctx->config.run_slice; i++) {
+        rvswd_sim_step_t res = rvswd_sim_step(ctx);
+        if (res == RVSWD_SIM_STEP_EBREAK && (ctx->dcsr & RVSWD_SIM_DCSR_EBREAKM)) {
+            ctx->dpc    = ctx->pc;
+            ctx->halted = true;
+            return;
+        } else if (res != RVSWD_SIM_STEP_OK) {
+            ctx->stalled = true;
+            return;
+        }
+    }
+}
+
+static void rvswd_sim_run_progbuf(rvswd_sim_ctx_t *ctx) {
+    uint32_t pc = ctx->pc;
+    ctx->pc     = RVSWD_SIM_PROGBUF_BASE;
+    for (uint32_t i = 0; i < RVSWD_SIM_PROGBUF_STEPS; i++) {
+        rvswd_sim_step_t res = rvswd_sim_step(ctx);
+        if (res == RVSWD_SIM_STEP_EBREAK) {
+            ctx->pc = pc;
+            return;
+        } else if (res != RVSWD_SIM_STEP_OK) {
+            break;
+        }
+    }
+    ctx->cmderr = RVSWD_SIM_CMDERR_EXCEPTION;
+    ctx->pc     = pc;
+}
+
+static void rvswd_sim_execute(rvswd_sim_ctx_t *ctx) {
+    uint32_t command = ctx->command;
+    if (ctx->cmderr != RVSWD_SIM_CMDERR_NONE) {
+        return;
+    }
+    if (!ctx->halted) {
+        ctx->cmderr = RVSWD_SIM_CMDERR_HALTRESUME;
+        return;
+    }
+
+    if (command & (1 << 17)) { // Transfer
+        uint16_t  regno = command & 0xFFFF;
+        uint32_t *reg;
+        if (regno >= 0x1000 && regno < 0x1020) {
+            reg = &ctx->x[regno - 0x1000];
+        } else if (regno < 0x1000) {
+            reg = rvswd_sim_csr(ctx, regno);
+        } else {
+            ctx->cmderr = RVSWD_SIM_CMDERR_EXCEPTION;
+            return;
+        }
+        if (command & (1 << 16)) {
+            if (reg != &ctx->x[0]) {
+                *reg = ctx->data[0];
+            }
+        } else {
+            ctx->data[0] = *reg;
+        }
+    }
+
+    if (command & (1 << 18)) { // Postexec
+        rvswd_sim_run_progbuf(ctx);
+    }
+}
+
+static void rvswd_sim_dmcontrol(rvswd_sim_ctx_t *ctx, uint32_t value) {
+    ctx->dmcontrol = value;
+    if (value & (1 << 28)) { // ackhavereset
+        ctx->havereset = false;
+    }
+    if (value & (1 << 1)) { // ndmreset
+        memset(ctx->x, 0, sizeof(ctx->x));
+        ctx->pc        = ctx->config.reset_vector;
+        ctx->stalled   = false;
+        ctx->havereset = true;
+        ctx->halted    = false; // Runs after the reset unless halted again below.
+    }
+    if (value & (1UL << 31)) { // haltreq
+        if (!ctx->halted) {
+            ctx->dpc       = ctx->pc;
+            ctx->halted    = true;
+            ctx->resumeack = false;
+        }
+    } else if (value & (1 << 30)) { // resumereq
+        ctx->resumeack = true;
+        if (ctx->halted) {
+            ctx->pc      = ctx->dpc;
+            ctx->halted  = false;
+            ctx->stalled = false;
+        }
+    }
+}
+
+static rvswd_result_t rvswd_sim_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+    rvswd_sim_ctx_t *ctx = handle->transport_ctx;
+    rvswd_sim_run(ctx);
+
+    if (reg == RVSWD_SIM_DATA0 || reg == RVSWD_SIM_DATA1) {
+        ctx->data[reg - RVSWD_SIM_DATA0] = value;
+        if (ctx->abstractauto & (1 << (reg - RVSWD_SIM_DATA0))) {
+            rvswd_sim_execute(ctx);
+        }
+    } else if (reg == RVSWD_SIM_DMCONTROL) {
+        rvswd_sim_dmcontrol(ctx, value);
+    } else if (reg == RVSWD_SIM_ABSTRACTCS) {
+        ctx->cmderr &= ~((value >> 8) & 7);
+    } else if (reg == RVSWD_SIM_COMMAND) {
+        ctx->command = value;
+        rvswd_sim_execute(ctx);
+    } else if (reg == RVSWD_SIM_ABSTRACTAUTO) {
+        ctx->abstractauto = value;
+    } else if (reg >= RVSWD_SIM_PROGBUF0 && reg <= RVSWD_SIM_PROGBUF7) {
+        ctx->progbuf[reg - RVSWD_SIM_PROGBUF0] = value;
+    }
+    return RVSWD_OK;
+}
+
+static rvswd_result_t rvswd_sim_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+    rvswd_sim_ctx_t *ctx = handle->transport_ctx;
+    rvswd_sim_run(ctx);
+
+    *value = 0;
+    if (reg == RVSWD_SIM_DATA0 || reg == RVSWD_SIM_DATA1) {
+        *value = ctx->data[reg - RVSWD_SIM_DATA0];
+        if (ctx->abstractauto & (1 << (reg - RVSWD_SIM_DATA0))) {
+            rvswd_sim_execute(ctx);
+        }
+    } else if (reg == RVSWD_SIM_DMCONTROL) {
+        *value = ctx->dmcontrol;
+    } else if (reg == RVSWD_SIM_DMSTATUS) {
+        uint32_t both = ctx->halted ? (3 << 8) : (3 << 10);
+        if (ctx->resumeack) {
+            both |= 3 << 16;
+        }
+        if (ctx->havereset) {
+            both |= 3 << 18;
+        }
+        *value = both | (1 << 7) | 2; // authenticated, debug spec 0.13
+    } else if (reg == RVSWD_SIM_HARTINFO) {
+        *value = (RVSWD_SIM_DATA_BASE & 0xFFF) | (2 << 12) | (1 << 16);
+    } else if (reg == RVSWD_SIM_ABSTRACTCS) {
+        *value = (8 << 24) | (ctx->cmderr << 8) | 2;
+    } else if (reg == RVSWD_SIM_COMMAND) {
+        *value = ctx->command;
+    } else if (reg == RVSWD_SIM_ABSTRACTAUTO) {
+        *value = ctx->abstractauto;
+    } else if (reg >= RVSWD_SIM_PROGBUF0 && reg <= RVSWD_SIM_PROGBUF7) {
+        *value = ctx->progbuf[reg - RVSWD_SIM_PROGBUF0];
+    }
+    return RVSWD_OK;
+}
+
+static rvswd_result_t rvswd_sim_init(rvswd_handle_t *handle) {
+    return handle->transport_ctx ? RVSWD_OK : RVSWD_INVALID_ARGS;
+}
+
+static rvswd_result_t rvswd_sim_reset(rvswd_handle_t *handle) {
+    return RVSWD_OK;
+}
+
+rvswd_transport_t const rvswd_transport_sim = {
+    .name  = "sim",
+    .init  = rvswd_sim_init,
+    .reset = rvswd_sim_reset,
+    .write = rvswd_sim_write,
+    .read  = rvswd_sim_read,
+};
+
+rvswd_result_t rvswd_sim_attach(rvswd_handle_t *handle, rvswd_sim_config_t const *config) {
+    if (handle == NULL || config == NULL || handle->transport_ctx != NULL) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    rvswd_sim_ctx_t *ctx = calloc(1, sizeof(rvswd_sim_ctx_t));
+    if (ctx == NULL) {
+        return RVSWD_FAIL;
+    }
+    ctx->config = *config;
+    if (ctx->config.run_slice == 0) {
+        ctx->config.run_slice = RVSWD_SIM_RUN_SLICE;
+    }
+    ctx->pc      = config->reset_vector;
+    ctx->stalled = true; // Nothing to run until the debugger resumes or resets the hart.
+
+    handle->transport     = &rvswd_transport_sim;
+    handle->transport_ctx = ctx;
+    return RVSWD_OK;
+}
+
+rvswd_result_t rvswd_sim_detach(rvswd_handle_t *handle) {
+    if (handle == NULL || handle->transport != &rvswd_transport_sim) {
+        return RVSWD_INVALID_ARGS;
+    }
+    free(handle->transport_ctx);
+
+    handle->transport     = &rvswd_transport_gpio_direct;
+    handle->transport_ctx = NULL;
+    return rvswd_init(handle);
+}
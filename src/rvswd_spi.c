@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "rvswd_spi.h"
+
+#include "esp_heap_caps.h"
+#include "esp_rom_gpio.h"
+#include "rvswd_internal.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/spi_periph.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Large enough for the longest SPI phase of a frame, rounded up to whole 32-bit words for DMA.
+#define RVSWD_SPI_BUFFER_SIZE 8
+
+static rvswd_result_t rvswd_spi_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value);
+static rvswd_result_t rvswd_spi_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value);
+static rvswd_result_t rvswd_spi_batch(rvswd_handle_t *handle, rvswd_op_t *ops, size_t count);
+
+typedef struct rvswd_spi_ctx {
+    spi_host_device_t   host;
+    spi_device_handle_t dev_out; // Mode 0: SWDIO is set up while SWCLK is low and sampled by the target on the rising edge.
+    spi_device_handle_t dev_in;  // Mode 1: the target drives SWDIO on the rising edge, we sample on the falling edge.
+    bool                polling;
+    uint8_t            *tx_buf;
+    uint8_t            *rx_buf;
+    spi_transaction_t   trans;
+} rvswd_spi_ctx_t;
+
+// Append `count` bits of `value`, MSB first, to an SPI transmit buffer.
+static void rvswd_spi_put_bits(uint8_t *buf, size_t *position, uint32_t value, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        if ((value >> (count - 1 - i)) & 1) {
+            buf[*position / 8] |= 0x80 >> (*position % 8);
+        }
+        (*position)++;
+    }
+}
+
+static bool rvswd_spi_parity(uint32_t value) {
+    return __builtin_parity(value);
+}
+
+// Hand SWDIO and SWCLK to the SPI peripheral. Must be called with SWCLK low, matching the mode 0/1 idle level.
+static void rvswd_spi_connect(rvswd_handle_t *handle, rvswd_spi_ctx_t *ctx) {
+    esp_rom_gpio_connect_out_signal(handle->swclk, spi_periph_signal[ctx->host].spiclk_out, false, false);
+    esp_rom_gpio_connect_out_signal(handle->swdio, spi_periph_signal[ctx->host].spid_out, false, false);
+    esp_rom_gpio_connect_in_signal(handle->swdio, spi_periph_signal[ctx->host].spid_in, false);
+}
+
+// Take SWDIO and SWCLK back to the GPIO matrix, both low, ready for the final bit and the stop condition.
+static void rvswd_spi_disconnect(rvswd_handle_t *handle) {
+    *handle->swclk_regs.w1tc = handle->swclk_regs.mask;
+    *handle->swdio_regs.w1tc = handle->swdio_regs.mask;
+    esp_rom_gpio_connect_out_signal(handle->swclk, SIG_GPIO_OUT_IDX, false, false);
+    esp_rom_gpio_connect_out_signal(handle->swdio, SIG_GPIO_OUT_IDX, false, false);
+}
+
+// Prepare the transaction, transmitting from the DMA buffer.
+static spi_transaction_t *rvswd_spi_trans(rvswd_spi_ctx_t *ctx) {
+    memset(&ctx->trans, 0, sizeof(ctx->trans));
+    memset(ctx->tx_buf, 0, RVSWD_SPI_BUFFER_SIZE);
+    ctx->trans.tx_buffer = ctx->tx_buf;
+    return &ctx->trans;
+}
+
+// Encode a complete write frame, except for the final trailer bit which is clocked by the GPIO so
+// SWCLK is left high for the stop condition.
+static void rvswd_spi_encode_write(spi_transaction_t *trans, uint8_t reg, uint32_t value) {
+    uint8_t *buf      = (uint8_t *)trans->tx_buffer;
+    size_t   position = 0;
+    rvswd_spi_put_bits(buf, &position, reg, 7);
+    rvswd_spi_put_bits(buf, &position, 1, 1);
+    rvswd_spi_put_bits(buf, &position, !rvswd_spi_parity(reg & 0x7F), 1);
+    rvswd_spi_put_bits(buf, &position, 0b10101, 5);
+    rvswd_spi_put_bits(buf, &position, value, 32);
+    rvswd_spi_put_bits(buf, &position, rvswd_spi_parity(value), 1);
+    rvswd_spi_put_bits(buf, &position, 0b1011, 4);
+    trans->length = position;
+}
+
+static esp_err_t rvswd_spi_transfer(rvswd_spi_ctx_t *ctx, spi_device_handle_t dev, spi_transaction_t *trans) {
+    if (ctx->polling) {
+        return spi_device_polling_transmit(dev, trans);
+    }
+    return spi_device_transmit(dev, trans);
+}
+
+rvswd_result_t rvswd_spi_attach(rvswd_handle_t *handle, rvswd_spi_config_t const *config) {
+    if (handle == NULL || config == NULL || handle->transport_ctx != NULL) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    rvswd_spi_ctx_t *ctx = calloc(1, sizeof(rvswd_spi_ctx_t));
+    if (ctx == NULL) {
+        return RVSWD_FAIL;
+    }
+    ctx->host    = config->host;
+    ctx->polling = config->polling;
+    ctx->tx_buf  = heap_caps_calloc(1, RVSWD_SPI_BUFFER_SIZE, MALLOC_CAP_DMA);
+    ctx->rx_buf  = heap_caps_calloc(1, RVSWD_SPI_BUFFER_SIZE, MALLOC_CAP_DMA);
+    if (ctx->tx_buf == NULL || ctx->rx_buf == NULL) {
+        goto error;
+    }
+
+    spi_bus_config_t bus_cfg = {
+        .mosi_io_num     = handle->swdio,
+        .miso_io_num     = -1,
+        .sclk_io_num     = handle->swclk,
+        .quadwp_io_num   = -1,
+        .quadhd_io_num   = -1,
+        .max_transfer_sz = RVSWD_SPI_BUFFER_SIZE,
+        // The start and stop conditions reroute the pins, which only works through the GPIO matrix.
+        .flags           = SPICOMMON_BUSFLAG_MASTER | SPICOMMON_BUSFLAG_GPIO_PINS,
+    };
+    if (spi_bus_initialize(ctx->host, &bus_cfg, SPI_DMA_CH_AUTO) != ESP_OK) {
+        goto error;
+    }
+
+    spi_device_interface_config_t dev_cfg = {
+        .mode           = 0,
+        .clock_speed_hz = config->clock_speed_hz,
+        .input_delay_ns = config->input_delay_ns,
+        .spics_io_num   = -1,
+        .flags          = SPI_DEVICE_3WIRE | SPI_DEVICE_HALFDUPLEX,
+        .queue_size     = 1,
+    };
+    if (spi_bus_add_device(ctx->host, &dev_cfg, &ctx->dev_out) != ESP_OK) {
+        goto error_bus;
+    }
+    dev_cfg.mode = 1;
+    if (spi_bus_add_device(ctx->host, &dev_cfg, &ctx->dev_in) != ESP_OK) {
+        goto error_dev;
+    }
+
+    handle->transport     = &rvswd_transport_spi;
+    handle->transport_ctx = ctx;
+
+    // Leave the pins on the GPIO matrix between frames.
+    return rvswd_init(handle);
+
+error_dev:
+    spi_bus_remove_device(ctx->dev_out);
+error_bus:
+    spi_bus_free(ctx->host);
+error:
+    free(ctx->tx_buf);
+    free(ctx->rx_buf);
+    free(ctx);
+    return RVSWD_FAIL;
+}
+
+rvswd_result_t rvswd_spi_detach(rvswd_handle_t *handle) {
+    if (handle == NULL || handle->transport != &rvswd_transport_spi) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    rvswd_spi_ctx_t *ctx = handle->transport_ctx;
+    spi_bus_remove_device(ctx->dev_in);
+    spi_bus_remove_device(ctx->dev_out);
+    spi_bus_free(ctx->host);
+    free(ctx->tx_buf);
+    free(ctx->rx_buf);
+    free(ctx);
+
+    handle->transport     = &rvswd_transport_gpio_direct;
+    handle->transport_ctx = NULL;
+    return rvswd_init(handle);
+}
+
+// The start and stop conditions and the final trailer bit are generated here in task context, they
+// busy-wait on the GPIO timing and must not run from the SPI interrupt.
+static rvswd_result_t rvswd_spi_write(rvswd_handle_t *handle, uint8_t reg, uint32_t value) {
+    rvswd_spi_ctx_t   *ctx   = handle->transport_ctx;
+    spi_transaction_t *trans = rvswd_spi_trans(ctx);
+    rvswd_spi_encode_write(trans, reg, value);
+
+    rvswd_start(handle);
+    rvswd_spi_connect(handle, ctx);
+    esp_err_t res = rvswd_spi_transfer(ctx, ctx->dev_out, trans);
+    rvswd_spi_disconnect(handle);
+    rvswd_write_bit(handle, 1);
+    rvswd_stop(handle);
+
+    return (res == ESP_OK) ? RVSWD_OK : RVSWD_FAIL;
+}
+
+static rvswd_result_t rvswd_spi_read(rvswd_handle_t *handle, uint8_t reg, uint32_t *value) {
+    rvswd_spi_ctx_t *ctx = handle->transport_ctx;
+
+    spi_transaction_t *trans    = rvswd_spi_trans(ctx);
+    uint8_t           *buf      = (uint8_t *)trans->tx_buffer;
+    size_t             position = 0;
+    rvswd_spi_put_bits(buf, &position, reg, 7);
+    rvswd_spi_put_bits(buf, &position, 0, 1);
+    rvswd_spi_put_bits(buf, &position, rvswd_spi_parity(reg & 0x7F), 1);
+    rvswd_spi_put_bits(buf, &position, 0b10101, 5);
+    trans->length = position;
+
+    rvswd_start(handle);
+    rvswd_spi_connect(handle, ctx);
+    esp_err_t res = rvswd_spi_transfer(ctx, ctx->dev_out, trans);
+    if (res == ESP_OK) {
+        // Turnaround: the output driver is disabled for the read phase and the target drives SWDIO.
+        trans            = rvswd_spi_trans(ctx);
+        trans->tx_buffer = NULL;
+        trans->rxlength  = 33;
+        trans->rx_buffer = ctx->rx_buf;
+        res              = rvswd_spi_transfer(ctx, ctx->dev_in, trans);
+    }
+    rvswd_spi_disconnect(handle);
+
+    rvswd_write_bit(handle, 1);
+    rvswd_write_bit(handle, 0);
+    rvswd_write_bit(handle, 1);
+    rvswd_write_bit(handle, 1);
+    rvswd_write_bit(handle, 1);
+    rvswd_stop(handle);
+
+    if (res != ESP_OK) {
+        return RVSWD_FAIL;
+    }
+
+    uint8_t const *rx = ctx->rx_buf;
+    *value = ((uint32_t)rx[0] << 24) | ((uint32_t)rx[1] << 16) | ((uint32_t)rx[2] << 8) | rx[3];
+    bool parity_read = rx[4] >> 7;
+
+    return (rvswd_spi_parity(*value) == parity_read) ? RVSWD_OK : RVSWD_FAIL;
+}
+
+// Consecutive writes keep the bus acquired for the write device, so the driver does not arbitrate
+// the bus for each frame. The turnaround of a read needs the second device, so a read releases it.
+static rvswd_result_t rvswd_spi_batch(rvswd_handle_t *handle, rvswd_op_t *ops, size_t count) {
+    rvswd_spi_ctx_t *ctx      = handle->transport_ctx;
+    bool             acquired = false;
+    rvswd_result_t   res      = RVSWD_OK;
+
+    for (size_t i = 0; i < count && res == RVSWD_OK; i++) {
+        if (ops[i].write) {
+            if (!acquired) {
+                if (spi_device_acquire_bus(ctx->dev_out, portMAX_DELAY) != ESP_OK) {
+                    return RVSWD_FAIL;
+                }
+                acquired = true;
+            }
+            res = rvswd_spi_write(handle, ops[i].reg, ops[i].value);
+            continue;
+        }
+
+        if (acquired) {
+            spi_device_release_bus(ctx->dev_out);
+            acquired = false;
+        }
+        uint32_t value = 0;
+        res            = rvswd_spi_read(handle, ops[i].reg, &value);
+        if (ops[i].result) {
+            *ops[i].result = value;
+        }
+    }
+
+    if (acquired) {
+        spi_device_release_bus(ctx->dev_out);
+    }
+    return res;
+}
+
+// Pins are parked on the GPIO matrix between frames, so setup and reset are shared with the bit-bang engine.
+rvswd_transport_t const rvswd_transport_spi = {
+    .name  = "spi",
+    .init  = rvswd_gpio_init,
+    .reset = rvswd_gpio_reset,
+    .write = rvswd_spi_write,
+    .read  = rvswd_spi_read,
+    .batch = rvswd_spi_batch,
+};
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2024 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "rvswd_timing.h"
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+static char const TAG[] = "rvswd_timing";
+
+#define RVSWD_TIMING_NVS_NAMESPACE "rvswd"
+
+// Debug module registers with stable content used as the reference pattern.
+#define RVSWD_TIMING_REG_DMSTATUS 0x11
+#define RVSWD_TIMING_REG_CPBR     0x7C
+
+// Candidates, from fastest to slowest.
+static uint16_t const rvswd_timing_half_periods[] = {0, 100, 250, 500, 1000, 2500};
+// Candidates, from slowest to fastest.
+static uint16_t const rvswd_timing_holds[] = {1000, 500, 250, 100, 50, 0};
+
+typedef struct rvswd_timing_reference {
+    uint32_t dmstatus;
+    uint32_t cpbr;
+} rvswd_timing_reference_t;
+
+static rvswd_result_t rvswd_timing_read_reference(rvswd_handle_t *handle, rvswd_timing_reference_t *reference) {
+    rvswd_result_t res = rvswd_read(handle, RVSWD_TIMING_REG_DMSTATUS, &reference->dmstatus);
+    if (res != RVSWD_OK) {
+        return res;
+    }
+    return rvswd_read(handle, RVSWD_TIMING_REG_CPBR, &reference->cpbr);
+}
+
+// Run `trials` reads of the reference pattern with `timing`, resynchronizing the bus on failure.
+static bool rvswd_timing_check(rvswd_handle_t *handle, rvswd_timing_t const *timing, uint32_t trials,
+                               rvswd_timing_reference_t const *reference) {
+    handle->timing = timing;
+    for (uint32_t i = 0; i < trials; i++) {
+        rvswd_timing_reference_t value;
+        if (rvswd_timing_read_reference(handle, &value) != RVSWD_OK || value.dmstatus != reference->dmstatus ||
+            value.cpbr != reference->cpbr) {
+            rvswd_reset(handle);
+            return false;
+        }
+    }
+    return true;
+}
+
+rvswd_result_t rvswd_timing_tune(rvswd_handle_t *handle, uint32_t trials, rvswd_timing_t *result) {
+    if (handle == NULL || result == NULL || trials == 0) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    // Tuning frames are expected to fail, keep them out of the handle's counters.
+    rvswd_stats_t            stats    = handle->stats;
+    rvswd_timing_t const    *previous = handle->timing;
+    rvswd_timing_reference_t reference;
+
+    handle->timing     = &rvswd_timing_default;
+    rvswd_result_t res = rvswd_timing_read_reference(handle, &reference);
+    if (res != RVSWD_OK) {
+        ESP_LOGE(TAG, "Failed to read the reference pattern with the default timing");
+        handle->timing = previous;
+        handle->stats  = stats;
+        return res;
+    }
+
+    rvswd_timing_t candidate = rvswd_timing_default;
+    rvswd_timing_t best;
+    size_t         i;
+    for (i = 0; i < sizeof(rvswd_timing_half_periods) / sizeof(rvswd_timing_half_periods[0]); i++) {
+        candidate.half_period_ns = rvswd_timing_half_periods[i];
+        if (rvswd_timing_check(handle, &candidate, trials, &reference)) {
+            break;
+        }
+    }
+    if (i == sizeof(rvswd_timing_half_periods) / sizeof(rvswd_timing_half_periods[0])) {
+        ESP_LOGE(TAG, "No half-period passes with the default hold times");
+        handle->timing = previous;
+        handle->stats  = stats;
+        return RVSWD_FAIL;
+    }
+    best = candidate;
+
+    for (i = 0; i < sizeof(rvswd_timing_holds) / sizeof(rvswd_timing_holds[0]); i++) {
+        candidate.start_hold_ns = rvswd_timing_holds[i];
+        candidate.stop_hold_ns  = rvswd_timing_holds[i];
+        if (!rvswd_timing_check(handle, &candidate, trials, &reference)) {
+            break;
+        }
+        best = candidate;
+    }
+
+    *result        = best;
+    handle->timing = result;
+    handle->stats  = stats;
+    ESP_LOGI(TAG, "Tuned timing: half-period %u ns, start hold %u ns, stop hold %u ns", result->half_period_ns,
+             result->start_hold_ns, result->stop_hold_ns);
+    return RVSWD_OK;
+}
+
+rvswd_result_t rvswd_timing_load(char const *key, rvswd_timing_t *timing) {
+    if (key == NULL || timing == NULL) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    nvs_handle_t nvs;
+    if (nvs_open(RVSWD_TIMING_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return RVSWD_FAIL;
+    }
+    size_t    size = sizeof(rvswd_timing_t);
+    esp_err_t err  = nvs_get_blob(nvs, key, timing, &size);
+    nvs_close(nvs);
+
+    return (err == ESP_OK && size == sizeof(rvswd_timing_t)) ? RVSWD_OK : RVSWD_FAIL;
+}
+
+rvswd_result_t rvswd_timing_save(char const *key, rvswd_timing_t const *timing) {
+    if (key == NULL || timing == NULL) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    nvs_handle_t nvs;
+    if (nvs_open(RVSWD_TIMING_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return RVSWD_FAIL;
+    }
+    esp_err_t err = nvs_set_blob(nvs, key, timing, sizeof(rvswd_timing_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+
+    return (err == ESP_OK) ? RVSWD_OK : RVSWD_FAIL;
+}
+
+rvswd_result_t rvswd_timing_autotune(rvswd_handle_t *handle, char const *key, uint32_t trials, rvswd_timing_t *timing) {
+    if (handle == NULL || key == NULL || timing == NULL || trials == 0) {
+        return RVSWD_INVALID_ARGS;
+    }
+
+    if (rvswd_timing_load(key, timing) == RVSWD_OK) {
+        rvswd_stats_t            stats = handle->stats;
+        rvswd_timing_reference_t reference;
+        handle->timing = &rvswd_timing_default;
+        bool valid     = rvswd_timing_read_reference(handle, &reference) == RVSWD_OK &&
+                     rvswd_timing_check(handle, timing, trials, &reference);
+        handle->stats = stats;
+        if (valid) {
+            ESP_LOGI(TAG, "Using stored timing: half-period %u ns, start hold %u ns, stop hold %u ns",
+                     timing->half_period_ns, timing->start_hold_ns, timing->stop_hold_ns);
+            return RVSWD_OK;
+        }
+        ESP_LOGW(TAG, "Stored timing no longer passes, tuning again");
+    }
+
+    rvswd_result_t res = rvswd_timing_tune(handle, trials, timing);
+    if (res != RVSWD_OK) {
+        return res;
+    }
+    if (rvswd_timing_save(key, timing) != RVSWD_OK) {
+        ESP_LOGW(TAG, "Failed to store tuned timing");
+    }
+    return RVSWD_OK;
+}
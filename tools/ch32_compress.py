@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024 Nicolai Electronics
+#
+# SPDX-License-Identifier: MIT
+#
+# Compress a CH32 firmware .bin into the format read by ch32_program_compressed, see
+# include/ch32_compressed.h.
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x5A323343  # "C32Z"
+VERSION = 1
+PAGE_SIZE = 256
+MIN_MATCH = 4
+MAX_OFFSET = 0xFFFF
+
+
+def crc32_words(data):
+    """CRC32 as computed by the CH32 CRC unit, over little-endian words."""
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack("<I", data):
+        crc ^= word
+        for _ in range(32):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else crc << 1
+            crc &= 0xFFFFFFFF
+    return crc
+
+
+def length_bytes(length):
+    out = bytearray()
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+    return out
+
+
+def sequence(literals, offset, match):
+    """One LZ4 sequence, the last one of a block has no match."""
+    token_literals = min(len(literals), 15)
+    token_match = 0 if match is None else min(match - MIN_MATCH, 15)
+    out = bytearray([token_literals << 4 | token_match])
+    if token_literals == 15:
+        out += length_bytes(len(literals) - 15)
+    out += literals
+    if match is not None:
+        out += struct.pack("<H", offset)
+        if token_match == 15:
+            out += length_bytes(match - MIN_MATCH - 15)
+    return out
+
+
+def compress(data, window):
+    """Compress page by page, matches reach back into earlier pages but stop at the page end."""
+    max_offset = min(window, MAX_OFFSET)
+    chains = {}  # 4-byte prefix -> positions, most recent last.
+    blocks = bytearray()
+
+    for start in range(0, len(data), PAGE_SIZE):
+        end = min(start + PAGE_SIZE, len(data))
+        block = bytearray()
+        literal_start = start
+        pos = start
+        while pos < end:
+            best_len, best_offset = 0, 0
+            if end - pos >= MIN_MATCH:
+                for candidate in reversed(chains.get(data[pos : pos + MIN_MATCH], [])[-64:]):
+                    if pos - candidate > max_offset:
+                        break
+                    length = 0
+                    while pos + length < end and data[candidate + length] == data[pos + length]:
+                        length += 1
+                    if length > best_len:
+                        best_len, best_offset = length, pos - candidate
+
+            if best_len >= MIN_MATCH:
+                block += sequence(data[literal_start:pos], best_offset, best_len)
+                next_pos = pos + best_len
+            else:
+                next_pos = pos + 1
+            for i in range(pos, next_pos):
+                if i + MIN_MATCH <= len(data):
+                    chains.setdefault(data[i : i + MIN_MATCH], []).append(i)
+            if best_len >= MIN_MATCH:
+                literal_start = next_pos
+            pos = next_pos
+
+        if literal_start < end or not block:
+            block += sequence(data[literal_start:end], 0, None)
+        blocks += struct.pack("<H", len(block)) + block
+
+    return blocks
+
+
+def decompress(blob):
+    """Reference decoder, used to check the output."""
+    magic, version, window_log, _, length, crc = struct.unpack_from("<IBBHII", blob)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a compressed image")
+    out = bytearray()
+    pos = 16
+    while len(out) < length:
+        (block_len,) = struct.unpack_from("<H", blob, pos)
+        pos += 2
+        block = blob[pos : pos + block_len]
+        pos += block_len
+        i = 0
+        while i < len(block):
+            token = block[i]
+            i += 1
+            literals = token >> 4
+            if literals == 15:
+                while True:
+                    literals += block[i]
+                    i += 1
+                    if block[i - 1] != 255:
+                        break
+            out += block[i : i + literals]
+            i += literals
+            if i == len(block):
+                break
+            (offset,) = struct.unpack_from("<H", block, i)
+            i += 2
+            match = token & 15
+            if match == 15:
+                while True:
+                    match += block[i]
+                    i += 1
+                    if block[i - 1] != 255:
+                        break
+            if offset == 0 or offset > 1 << window_log:
+                raise ValueError("bad offset")
+            for _ in range(match + MIN_MATCH):
+                out.append(out[-offset])
+    return bytes(out), crc
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compress a CH32 firmware image for ch32_program_compressed.")
+    parser.add_argument("input", help="firmware .bin")
+    parser.add_argument("output", help="compressed image")
+    parser.add_argument("--window-log", type=int, default=12, help="match window as a power of two (8 to 16)")
+    args = parser.parse_args()
+
+    if not 8 <= args.window_log <= 16:
+        parser.error("--window-log must be 8 to 16")
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    padded = data + b"\xff" * (-len(data) % PAGE_SIZE)
+    header = struct.pack("<IBBHII", MAGIC, VERSION, args.window_log, 0, len(data), crc32_words(padded))
+    blob = header + compress(data, 1 << args.window_log)
+
+    decoded, _ = decompress(blob)
+    if decoded != data:
+        sys.exit("ch32_compress: decompression check failed")
+
+    with open(args.output, "wb") as f:
+        f.write(blob)
+    print(f"ch32_compress: {len(data)} -> {len(blob)} bytes")
+
+
+if __name__ == "__main__":
+    main()